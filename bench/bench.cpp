@@ -0,0 +1,789 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  bench.cpp
+
+  A benchmark for the fan-out path. It starts a Server in-process,
+  attaches a number of receivers to it over a number of connections,
+  using a second Proton container as the client, and then publishes
+  messages through Server::publish(), as fast as possible or at a set
+  rate. It reports the throughput; the 50th, 99th and 99.9th 
+  percentile latency from publishing a message to a receiver getting
+  it; the CPU time and heap allocations per message; the memory in 
+  use; and how many work items the Queues scheduled per message. 
+
+  With --csv, the results are also appended to a CSV file, so that 
+  runs with different versions, or different settings, can be 
+  compared. The CPU time and memory are for the whole process, which
+  includes the receivers.
+
+  With --shards, the server runs that many Shards, on consecutive 
+  ports, and the connections are spread evenly over them.
+
+  With --metric, it publishes a Metric, with a unit and two labels, 
+  rather than a text message, so the cost of the two publishing 
+  paths can be compared.
+
+  With --shm, the queue also has a shared memory ring with that many
+  slots, and a thread reads it with ShmReader, as a local client 
+  would, while the messages are published. It reports how many 
+  messages the reader got, and how many it lost by being lapped, and
+  how often it had to wait. A ring smaller than the number of 
+  messages exercises the lapping path. The reader's CPU time is 
+  included in the process's.
+
+  With --churn, it instead soaks the server with short-lived clients:
+  each one connects, attaches its receivers, and disconnects at once.
+  It reports the time and allocations per connection, and how the 
+  memory in use changed, which should be not at all once the Sender
+  and ConnectionHandler pools are warm.
+
+  Build with "make bench".
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <proton/connection.hpp>
+#include <proton/container.hpp>
+#include <proton/delivery.hpp>
+#include <proton/message.hpp>
+#include <proton/messaging_handler.hpp>
+#include <proton/receiver.hpp>
+#include <proton/receiver_options.hpp>
+#include <proton/codec/decoder.hpp>
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "ConnectionHandler.h"
+#include "config.h"
+#include "Metric.h"
+#include "Sender.h"
+#include "Server.h"
+#include "ShmReader.h"
+#include "Spool.h"
+#include "Stats.h"
+#include "logging.h"
+
+int log_level = 0;
+
+#define BENCH_QUEUE "bench"
+
+/*=====================================================================
+
+  Allocation counting. We replace the global operator new, so we can
+  count every heap allocation made in the process, including those 
+  made by Proton.
+
+=====================================================================*/
+
+static std::atomic<unsigned long> allocations (0);
+
+void *operator new (size_t n)
+  {
+  allocations++;
+  void *p = malloc (n == 0 ? 1 : n);
+  if (!p) throw std::bad_alloc();
+  return p;
+  }
+
+void operator delete (void *p) noexcept
+  {
+  free (p);
+  }
+
+/*=====================================================================
+
+  LatencyHistogram records latencies in nanoseconds, in buckets whose
+  width is a sixteenth of a power of two. So percentiles are accurate
+  to about 6%, whatever the scale, and the histogram has a fixed 
+  size, however many messages are received.
+
+=====================================================================*/
+class LatencyHistogram
+  {
+  private:
+
+  static const int SUB = 16;
+  static const int BUCKETS = SUB + 60 * SUB;
+  uint64_t counts[BUCKETS];
+  uint64_t total;
+
+  static int bucket (uint64_t ns)
+    {
+    if (ns < SUB) return ns;
+    int e = 63 - __builtin_clzll (ns);
+    return SUB + (e - 4) * SUB + (int)((ns >> (e - 4)) - SUB);
+    }
+
+  /** The largest value that falls in a bucket. */
+  static uint64_t upper (int b)
+    {
+    if (b < SUB) return b;
+    int e = (b - SUB) / SUB + 4;
+    uint64_t lower = (uint64_t)(SUB + (b - SUB) % SUB) << (e - 4);
+    return lower + ((uint64_t)1 << (e - 4)) - 1;
+    }
+
+  public:
+
+  LatencyHistogram() : total (0)
+    {
+    memset (counts, 0, sizeof (counts));
+    }
+
+  void add (uint64_t ns)
+    {
+    counts[bucket (ns)]++;
+    total++;
+    }
+
+  uint64_t get_total() const { return total; }
+
+  /** Get the latency, in nanoseconds, below which the given fraction
+      of the latencies fell. */
+  uint64_t percentile (double fraction) const
+    {
+    if (total == 0) return 0;
+    uint64_t wanted = (uint64_t)(total * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+      {
+      seen += counts[i];
+      if (seen > wanted) return upper (i);
+      }
+    return upper (BUCKETS - 1);
+    }
+  };
+
+/*=====================================================================
+
+  BenchClient is the messaging_handler for the client container. It 
+  opens the specified number of connections, spread evenly over the
+  URLs (one for each Shard), and spreads the receivers evenly over 
+  the connections. It counts the receivers that have been
+  attached, and the messages that have arrived, and records the 
+  latency of each message, from the time the publisher put in its
+  "sent" property, or, for a Metric, its monotonic time.
+
+=====================================================================*/
+class BenchClient : public proton::messaging_handler
+  {
+  private:
+
+  std::vector<std::string> urls;
+  int connections;
+  int receivers;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  int attached;
+  unsigned long received;
+  LatencyHistogram latency;
+
+  public:
+
+  BenchClient (const std::vector<std::string> &u, int c, int r) :
+      urls (u), connections (c), receivers (r), attached (0), received (0)
+    {
+    }
+
+  void on_container_start (proton::container &c) override
+    {
+    for (int i = 0; i < connections; i++)
+      {
+      proton::connection conn = c.connect (urls[i % urls.size()]);
+      // Receivers are numbered 0..receivers-1, and receiver n goes
+      //   on connection n % connections.
+      for (int n = i; n < receivers; n += connections)
+        conn.open_receiver (BENCH_QUEUE);
+      }
+    }
+
+  void on_receiver_open (proton::receiver &) override
+    {
+    std::lock_guard<std::mutex> l (lock);
+    attached++;
+    changed.notify_all();
+    }
+
+  void on_message (proton::delivery &, proton::message &m) override
+    {
+    uint64_t now = Stats::now();
+    uint64_t sent;
+    if (m.properties().exists ("sent"))
+      sent = proton::coerce<uint64_t> (m.properties().get ("sent"));
+    else
+      {
+      // [name, value, unit, monotonic time, ...] -- see Metric.h
+      proton::codec::decoder d (m.body());
+      proton::codec::start s;
+      std::string name;
+      double value;
+      proton::symbol unit;
+      int64_t monotonic;
+      d >> s >> name >> value >> unit >> monotonic;
+      sent = monotonic;
+      }
+    std::lock_guard<std::mutex> l (lock);
+    latency.add (now > sent ? now - sent : 0);
+    received++;
+    changed.notify_all();
+    }
+
+  /** Wait until all the receivers have been attached. Returns false 
+      on timeout. */
+  bool wait_attached (int seconds)
+    {
+    std::unique_lock<std::mutex> l (lock);
+    return changed.wait_for (l, std::chrono::seconds (seconds), 
+      [this] { return attached >= receivers; });
+    }
+
+  /** Wait until the specified number of messages has been received. 
+      Returns false on timeout. */
+  bool wait_received (unsigned long n, int seconds)
+    {
+    std::unique_lock<std::mutex> l (lock);
+    return changed.wait_for (l, std::chrono::seconds (seconds), 
+      [this, n] { return received >= n; });
+    }
+
+  /** Get the number of messages received, and a copy of their 
+      latencies. */
+  unsigned long get_received (LatencyHistogram &h)
+    {
+    std::lock_guard<std::mutex> l (lock);
+    h = latency;
+    return received;
+    }
+  };
+
+/*=====================================================================
+
+  ShmBenchReader reads a shared memory ring in a thread of its own, 
+  until it has accounted for the specified number of messages, read
+  or lost, or the ring is closed, or the time is up. 
+
+=====================================================================*/
+class ShmBenchReader
+  {
+  private:
+
+  ShmReader *reader;
+  unsigned long expected;
+  int seconds;
+  std::thread thread;
+
+  unsigned long read;
+  unsigned long lost;
+  unsigned long lapped;
+  unsigned long waits;
+  unsigned long out_of_order;
+
+  void run()
+    {
+    std::chrono::steady_clock::time_point deadline = 
+      std::chrono::steady_clock::now() + std::chrono::seconds (seconds);
+    ShmRecord r;
+    uint64_t last = 0;
+    while (read + lost < expected 
+        && std::chrono::steady_clock::now() < deadline)
+      {
+      uint64_t n;
+      ShmReader::Result res = reader->read (r, n);
+      if (res == ShmReader::READ)
+        {
+        if (read > 0 && r.seq <= last) out_of_order++;
+        last = r.seq;
+        read++;
+        }
+      else if (res == ShmReader::LAPPED)
+        {
+        lost += n;
+        lapped++;
+        }
+      else if (res == ShmReader::EMPTY)
+        {
+        if (reader->wait (100)) waits++;
+        }
+      else
+        break;
+      }
+    }
+
+  public:
+
+  ShmBenchReader (ShmReader *r, unsigned long e, int s) : 
+      reader (r), expected (e), seconds (s), read (0), lost (0), 
+      lapped (0), waits (0), out_of_order (0)
+    {
+    thread = std::thread (&ShmBenchReader::run, this);
+    }
+
+  ~ShmBenchReader() 
+    {
+    delete reader;
+    }
+
+  /** Wait for the reader to finish, and print what it found. */
+  void report()
+    {
+    thread.join();
+    std::cout << "shm messages read:        " << read << std::endl;
+    std::cout << "shm messages lost:        " << lost << " (lapped " 
+      << lapped << " times)" << std::endl;
+    std::cout << "shm waits:                " << waits << std::endl;
+    std::cout << "shm out of order:         " << out_of_order << std::endl;
+    }
+  };
+
+/*=====================================================================
+
+  cpu_seconds
+
+  Get the CPU time used by the process, user and system.
+
+=====================================================================*/
+static double cpu_seconds()
+  {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  }
+
+/*=====================================================================
+
+  rss_kb
+
+  Get the resident set size of the process now, and its peak, in 
+  kilobytes.
+
+=====================================================================*/
+static void rss_kb (long &now, long &peak)
+  {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  peak = ru.ru_maxrss;
+  now = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+  if (f)
+    {
+    long size, resident;
+    if (fscanf (f, "%ld %ld", &size, &resident) == 2)
+      now = resident * (sysconf (_SC_PAGESIZE) / 1024);
+    fclose (f);
+    }
+  }
+
+/*=====================================================================
+
+  ChurnClient is the messaging_handler for the client container in 
+  --churn mode. It opens a connection with the specified number of
+  receivers, and closes it as soon as they are all attached. When the
+  server has acknowledged the close, it opens the next connection.
+
+=====================================================================*/
+class ChurnClient : public proton::messaging_handler
+  {
+  private:
+
+  std::string url;
+  int receivers;
+  int cycles;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  int attached;
+  int completed;
+
+  void connect (proton::container &c)
+    {
+    attached = 0;
+    proton::connection conn = c.connect (url);
+    for (int i = 0; i < receivers; i++)
+      conn.open_receiver (BENCH_QUEUE);
+    }
+
+  public:
+
+  ChurnClient (const std::string &u, int r, int c) :
+      url (u), receivers (r), cycles (c), attached (0), completed (0)
+    {
+    }
+
+  void on_container_start (proton::container &c) override
+    {
+    connect (c);
+    }
+
+  void on_receiver_open (proton::receiver &r) override
+    {
+    if (++attached == receivers) r.connection().close();
+    }
+
+  void on_connection_close (proton::connection &c) override
+    {
+    int n;
+      {
+      std::lock_guard<std::mutex> l (lock);
+      n = ++completed;
+      changed.notify_all();
+      }
+    if (n < cycles) connect (c.container());
+    }
+
+  /** Wait until the specified number of connections have been opened
+      and closed. Returns false on timeout. */
+  bool wait_completed (int n, int seconds)
+    {
+    std::unique_lock<std::mutex> l (lock);
+    return changed.wait_for (l, std::chrono::seconds (seconds), 
+      [this, n] { return completed >= n; });
+    }
+  };
+
+/*=====================================================================
+
+  run_churn
+
+  Run the --churn benchmark. The first tenth of the connections warm
+  up the pools, and are not measured. Returns the exit status.
+
+=====================================================================*/
+static int run_churn (const std::string &address, int cycles, 
+      int receivers, int wait)
+  {
+  ChurnClient client (address, receivers, cycles);
+  proton::container client_container (client);
+  std::thread client_thread ([&client_container] 
+    { client_container.run(); });
+
+  int warmup = cycles / 10 > 0 ? cycles / 10 : 1;
+  if (warmup >= cycles) warmup = 0;
+  if (warmup > 0 && !client.wait_completed (warmup, wait))
+    {
+    std::cerr << "Timed out warming up" << std::endl;
+    return 1;
+    }
+
+  long rss_before, max_rss;
+  rss_kb (rss_before, max_rss);
+  unsigned long alloc_before = allocations;
+  double cpu_before = cpu_seconds();
+  std::chrono::steady_clock::time_point start = 
+    std::chrono::steady_clock::now();
+
+  bool complete = client.wait_completed (cycles, wait);
+
+  double secs = std::chrono::duration<double> 
+    (std::chrono::steady_clock::now() - start).count();
+  double cpu = cpu_seconds() - cpu_before;
+  unsigned long allocs = allocations - alloc_before;
+  // Give the server a moment to finish releasing the last Senders
+  usleep (500000);
+  long rss_after;
+  rss_kb (rss_after, max_rss);
+  int measured = cycles - warmup;
+
+  std::cout << "connections:                 " << cycles 
+    << (complete ? "" : " (timed out)") << std::endl;
+  std::cout << "receivers per connection:    " << receivers << std::endl;
+  std::cout << "connections per second:      " << measured / secs 
+    << std::endl;
+  std::cout << "CPU per connection (us):     " << cpu * 1e6 / measured 
+    << std::endl;
+  std::cout << "allocations per connection:  " 
+    << (double)allocs / measured << std::endl;
+  std::cout << "RSS after warm-up (kB):      " << rss_before << std::endl;
+  std::cout << "RSS at end (kB):             " << rss_after 
+    << " (peak " << max_rss << ")" << std::endl;
+  std::cout << "Senders created/reused:      " 
+    << Sender::get_pool().get_created() << "/" 
+    << Sender::get_pool().get_reused() << std::endl;
+  std::cout << "ConnectionHandlers created/reused: " 
+    << ConnectionHandler::get_pool().get_created() << "/" 
+    << ConnectionHandler::get_pool().get_reused() << std::endl;
+  return complete ? 0 : 1;
+  }
+
+/*=====================================================================
+
+  show_help
+
+=====================================================================*/
+void show_help (void)
+  {
+  std::cout << NAME << "-bench [options]" << std::endl;
+  std::cout << "   -c, --connections  client connections (1)" << std::endl;
+  std::cout << "   -C, --churn        open and close this many connections,"
+    << std::endl;
+  std::cout << "                      each with the receivers, and report"
+    " the cost" << std::endl;
+  std::cout << "   -f, --csv          append the results to this CSV file" 
+    << std::endl;
+  std::cout << "   -m, --messages     messages to publish (1000)" 
+    << std::endl;
+  std::cout << "   -M, --metric       publish Metrics, not text messages" 
+    << std::endl;
+  std::cout << "   -p, --port         listen port number (5673)" 
+    << std::endl;
+  std::cout << "   -r, --receivers    receivers, spread over the connections"
+    " (10)" << std::endl;
+  std::cout << "   -S, --shm          write the queue to a shared memory ring"
+    " with this" << std::endl;
+  std::cout << "                      many slots, and read it in a thread"
+    << std::endl;
+  std::cout << "   -s, --shards       server shards, on consecutive ports (1)" 
+    << std::endl;
+  std::cout << "   -t, --rate         messages per second, or 0 for as fast as"
+    " possible (0)" << std::endl;
+  std::cout << "   -w, --wait         seconds to wait for delivery (60)" 
+    << std::endl;
+  }
+
+/*=====================================================================
+
+  main 
+
+=====================================================================*/
+int main (int argc, char **argv)
+  {
+  static struct option long_options[] =
+    {
+      {"help", no_argument, NULL, 'h'},
+      {"connections", required_argument, NULL, 'c'},
+      {"churn", required_argument, NULL, 'C'},
+      {"csv", required_argument, NULL, 'f'},
+      {"messages", required_argument, NULL, 'm'},
+      {"metric", no_argument, NULL, 'M'},
+      {"port", required_argument, NULL, 'p'},
+      {"receivers", required_argument, NULL, 'r'},
+      {"shards", required_argument, NULL, 's'},
+      {"shm", required_argument, NULL, 'S'},
+      {"rate", required_argument, NULL, 't'},
+      {"wait", required_argument, NULL, 'w'},
+      {0, 0, 0, 0}
+    };
+
+  int connections = 1;
+  int churn = 0;
+  int receivers = 10;
+  int shards = 1;
+  int messages = 1000;
+  int shm_slots = 0;
+  bool metric = false;
+  double rate = 0;
+  int wait = 60;
+  std::string port = "5673";
+  std::string csv;
+
+  int opt;
+  while ((opt = getopt_long (argc, argv, "hc:C:f:m:Mp:r:s:S:t:w:", long_options, 
+       NULL)) != -1)
+    {
+    switch (opt)
+      {
+      case 'c': connections = atoi (optarg); break;
+      case 'C': churn = atoi (optarg); break;
+      case 'f': csv = optarg; break;
+      case 'm': messages = atoi (optarg); break;
+      case 'M': metric = true; break;
+      case 'p': port = optarg; break;
+      case 'r': receivers = atoi (optarg); break;
+      case 's': shards = atoi (optarg); break;
+      case 'S': shm_slots = atoi (optarg); break;
+      case 't': rate = atof (optarg); break;
+      case 'w': wait = atoi (optarg); break;
+      default: show_help(); return 1;
+      }
+    }
+
+  if (connections < 1 || receivers < 1 || messages < 1 || rate < 0 
+        || wait < 1 || churn < 0 || shards < 1 
+        || shm_slots < 0)
+    {
+    show_help();
+    return 1;
+    }
+
+  std::string address = (std::string) "127.0.0.1:" + port;
+  Server server (address, shards);
+  if (shm_slots > 0)
+    {
+    QueuePolicy p;
+    if (!p.parse ("shm=" + std::to_string (shm_slots)))
+      {
+      show_help();
+      return 1;
+      }
+    server.set_queue_policy (BENCH_QUEUE, p);
+    }
+  std::thread server_thread (&Server::run, &server);
+
+  if (churn > 0) _exit (run_churn (address, churn, receivers, wait));
+
+  std::vector<std::string> urls;
+  for (int i = 0; i < shards; i++)
+    urls.push_back ("127.0.0.1:" + std::to_string (atoi (port.c_str()) + i));
+  BenchClient client (urls, connections, receivers);
+  proton::container client_container (client);
+  std::thread client_thread ([&client_container] 
+    { client_container.run(); });
+
+  if (!client.wait_attached (30))
+    {
+    std::cerr << "Timed out attaching receivers" << std::endl;
+    exit (1);
+    }
+  // The receivers are attached, but the Queue subscribes them 
+  //   asynchronously. Give it a moment.
+  usleep (500000);
+
+  // The Queue, and so its ring, exists now that it has subscribers
+  ShmBenchReader *shm_reader = 0;
+  if (shm_slots > 0)
+    {
+    std::string error;
+    ShmReader *r = ShmReader::open (SHM_DIR "/" NAME "." 
+      + Spool::escape (BENCH_QUEUE), error);
+    if (!r)
+      {
+      std::cerr << "Can't open shared memory ring: " << error 
+        << std::endl;
+      exit (1);
+      }
+    shm_reader = new ShmBenchReader (r, messages, wait);
+    }
+
+  Stats::Snapshot stats;
+  Stats::snapshot (stats);
+  unsigned long work_before = stats.counters[Stats::FANOUT_ITEMS];
+  unsigned long alloc_before = allocations;
+  double cpu_before = cpu_seconds();
+  std::chrono::steady_clock::time_point start = 
+    std::chrono::steady_clock::now();
+
+  // At a fixed rate, each message has a deadline, measured from the 
+  //   start, so that time spent publishing does not slow the rate.
+  std::chrono::nanoseconds interval (rate > 0 ? (long long)(1e9 / rate) : 0);
+  proton::message::property_map props;
+  Metric m (BENCH_QUEUE, "B/s");
+  m.label ("device", "sda").label ("host", "bench");
+  for (int i = 0; i < messages; i++)
+    {
+    if (rate > 0) std::this_thread::sleep_until (start + i * interval);
+    if (metric)
+      // set() takes the monotonic time, which is also the send time
+      server.publish (m.set (i));
+    else
+      {
+      props.put ("sent", Stats::now());
+      server.publish (BENCH_QUEUE, "bench", props);
+      }
+    }
+  double publish_secs = std::chrono::duration<double> 
+    (std::chrono::steady_clock::now() - start).count();
+
+  unsigned long expected = (unsigned long)messages * receivers;
+  bool complete = client.wait_received (expected, wait);
+
+  double secs = std::chrono::duration<double> 
+    (std::chrono::steady_clock::now() - start).count();
+  double cpu = cpu_seconds() - cpu_before;
+  Stats::snapshot (stats);
+  unsigned long work = stats.counters[Stats::FANOUT_ITEMS] - work_before;
+  unsigned long allocs = allocations - alloc_before;
+  LatencyHistogram latency;
+  unsigned long received = client.get_received (latency);
+  long rss, max_rss;
+  rss_kb (rss, max_rss);
+
+  double p50 = latency.percentile (0.5) / 1e3;
+  double p99 = latency.percentile (0.99) / 1e3;
+  double p999 = latency.percentile (0.999) / 1e3;
+
+  std::cout << "receivers:                " << receivers << std::endl;
+  std::cout << "connections:              " << connections << std::endl;
+  std::cout << "shards:                   " << shards << std::endl;
+  std::cout << "message type:             " 
+    << (metric ? "metric" : "text") << std::endl;
+  std::cout << "messages published:       " << messages << std::endl;
+  std::cout << "publish rate (msg/s):     " << messages / publish_secs 
+    << std::endl;
+  std::cout << "messages delivered:       " << received << " of " << expected 
+    << (complete ? "" : " (timed out)") << std::endl;
+  std::cout << "elapsed (s):              " << secs << std::endl;
+  std::cout << "deliveries per second:    " << received / secs << std::endl;
+  std::cout << "latency p50 (us):         " << p50 << std::endl;
+  std::cout << "latency p99 (us):         " << p99 << std::endl;
+  std::cout << "latency p99.9 (us):       " << p999 << std::endl;
+  std::cout << "CPU per publish (us):     " << cpu * 1e6 / messages 
+    << std::endl;
+  std::cout << "CPU per delivery (us):    " 
+    << (received ? cpu * 1e6 / received : 0) << std::endl;
+  std::cout << "RSS (kB):                 " << rss << " (peak " << max_rss 
+    << ")" << std::endl;
+  std::cout << "work items per publish:   " << (double)work / messages 
+    << std::endl;
+  std::cout << "allocations per publish:  " << (double)allocs / messages 
+    << std::endl;
+  std::cout << "allocations per delivery: " 
+    << (received ? (double)allocs / received : 0) << std::endl;
+  if (shm_reader)
+    {
+    shm_reader->report();
+    delete shm_reader;
+    }
+
+  if (!csv.empty())
+    {
+    FILE *f = fopen (csv.c_str(), "a");
+    if (!f)
+      {
+      std::cerr << "Can't open " << csv << ": " << strerror (errno) 
+        << std::endl;
+      _exit (1);
+      }
+    // Write a header if the file is new
+    fseek (f, 0, SEEK_END);
+    if (ftell (f) == 0)
+      fprintf (f, "version,receivers,connections,messages,rate,"
+        "publish_rate,delivered,elapsed,deliveries_per_sec,"
+        "latency_p50_us,latency_p99_us,latency_p999_us,"
+        "cpu_us_per_publish,cpu_us_per_delivery,rss_kb,max_rss_kb,"
+        "work_items_per_publish,allocs_per_publish,allocs_per_delivery,"
+        "shards,type\n");
+    fprintf (f, "%s,%d,%d,%d,%g,%g,%lu,%g,%g,%g,%g,%g,%g,%g,%ld,%ld,"
+      "%g,%g,%g,%d,%s\n", VERSION, receivers, connections, messages, rate, 
+      messages / publish_secs, received, secs, received / secs, 
+      p50, p99, p999, cpu * 1e6 / messages, 
+      received ? cpu * 1e6 / received : 0, rss, max_rss, 
+      (double)work / messages, (double)allocs / messages, 
+      received ? (double)allocs / received : 0, shards, 
+      metric ? "metric" : "text");
+    fclose (f);
+    }
+
+  // Neither container can be shut down cleanly from here, so just
+  //   exit.
+  _exit (complete ? 0 : 1);
+  }
+
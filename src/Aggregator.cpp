@@ -0,0 +1,93 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Aggregator.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "Aggregator.h"
+#include "TopicTrie.h"
+
+Aggregator::Aggregator (const std::string &b, const std::string &d,
+       Function f, double p) :
+        base (b), derived (d), function (f), period (p), window_start (-1),
+        count (0), sum (0), min (0), max (0)
+  {
+  }
+
+Aggregator *Aggregator::parse (const std::string &address)
+  {
+  if (TopicTrie::is_pattern (address)) return 0;
+
+  // The last level is the period, and the one before is the function
+  size_t dot2 = address.rfind ('.');
+  if (dot2 == std::string::npos || dot2 == 0) return 0;
+  size_t dot1 = address.rfind ('.', dot2 - 1);
+  if (dot1 == std::string::npos || dot1 == 0) return 0;
+
+  std::string f = address.substr (dot1 + 1, dot2 - dot1 - 1);
+  Function function;
+  if (f == "avg") function = AVG;
+  else if (f == "min") function = MIN;
+  else if (f == "max") function = MAX;
+  else if (f == "count") function = COUNT;
+  else if (f == "sum") function = SUM;
+  else return 0;
+
+  std::string p = address.substr (dot2 + 1);
+  char *end = 0;
+  long n = strtol (p.c_str(), &end, 10);
+  if (end == p.c_str() || n <= 0) return 0;
+  std::string unit = end;
+  double period;
+  if (unit == "s") period = n;
+  else if (unit == "m") period = n * 60.0;
+  else if (unit == "h") period = n * 3600.0;
+  else return 0;
+
+  return new Aggregator (address.substr (0, dot1), address, function, 
+    period);
+  }
+
+bool Aggregator::add (double time, double value, double &result, 
+      unsigned long &samples)
+  {
+  std::lock_guard<std::mutex> guard (lock);
+
+  bool done = false;
+  double start = floor (time / period) * period;
+  // A sample from another thread might arrive just after one that was
+  //   taken later -- it just goes in the current window.
+  if (start > window_start)
+    {
+    if (count > 0)
+      {
+      switch (function)
+        {
+        case AVG: result = sum / count; break;
+        case MIN: result = min; break;
+        case MAX: result = max; break;
+        case COUNT: result = count; break;
+        case SUM: result = sum; break;
+        }
+      samples = count;
+      done = true;
+      }
+    window_start = start;
+    count = 0;
+    sum = 0;
+    }
+
+  if (count == 0 || value < min) min = value;
+  if (count == 0 || value > max) max = value;
+  sum += value;
+  count++;
+  return done;
+  }
+
@@ -0,0 +1,85 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Aggregator.h
+
+  An Aggregator computes a summary -- average, minimum, maximum, count
+  or sum -- of the values published to a queue, over fixed periods of
+  time, and the QueueManager publishes each result to a derived queue.
+  The derived queue's name is the name of the queue it summarizes, 
+  with the function and the period added as two extra levels, like
+  "loadavg.1.avg.60s" (periods can also be given in minutes or hours,
+  like "loadavg.1.max.5m"). The value summarized is the numeric 
+  "value" property of each message, which every metric carries.
+
+  The periods are "tumbling" windows: they do not overlap, and each 
+  starts at a multiple of the period on the monotonic clock. A result
+  is published when the first sample of the next period arrives. The
+  Aggregator keeps only the running totals for the current period, so
+  each sample takes constant time and memory.
+
+  Samples can be added from any thread, so the totals are protected
+  by a mutex. It is held only while the totals are updated.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+
+class Aggregator
+  {
+  public:
+
+  enum Function { AVG, MIN, MAX, COUNT, SUM };
+
+  private:
+
+  /** The queue being summarized. */
+  const std::string base;
+
+  /** The derived queue, to which the results are published. */
+  const std::string derived;
+
+  const Function function;
+
+  /** The length of each window, in seconds. */
+  const double period;
+
+  std::mutex lock;
+
+  /** The start of the current window, or a negative number before 
+      the first sample. */
+  double window_start;
+  unsigned long count;
+  double sum;
+  double min;
+  double max;
+
+  Aggregator (const std::string &base, const std::string &derived, 
+    Function function, double period);
+
+  public:
+
+  /** If the address names a derived queue, like "loadavg.1.avg.60s",
+      create an Aggregator for it. Otherwise return null. The caller
+      owns the returned object. */
+  static Aggregator *parse (const std::string &address);
+
+  /** Add a sample, taken at the given time, in seconds on the 
+      monotonic clock. If the sample falls in a new window, and the
+      previous window had any samples, set result and samples to the
+      summary of the previous window, and return true. This method is
+      thread-safe. */
+  bool add (double time, double value, double &result, 
+    unsigned long &samples);
+
+  const std::string& get_base() const { return base; }
+  const std::string& get_derived() const { return derived; }
+  double get_period() const { return period; }
+  };
+
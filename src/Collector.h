@@ -0,0 +1,74 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Collector.h
+
+  A Collector gathers one or more metrics from the system, and passes
+  each one, as a Metric, to a MetricSink. The 
+  monitor thread calls every Collector in turn, and its sink 
+  publishes each metric to the queue of the same name.
+
+  Collectors are called repeatedly for the lifetime of the program,
+  so they should do any expensive setup -- opening files, building
+  Metrics with their names, units and labels -- once, and then reuse
+  it.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+#include "Metric.h"
+
+/** A MetricSink receives the metrics produced by Collectors. */
+class MetricSink
+  {
+  public:
+
+  virtual ~MetricSink() {}
+
+  /** Receive one metric. Its name is also the name of the queue to
+      which it will be published. */
+  virtual void metric (const Metric& m) = 0;
+  };
+
+/** Collector is the interface for all metric collectors. */
+class Collector
+  {
+  public:
+
+  virtual ~Collector() {}
+
+  /** A short name for this collector, for logging. */
+  virtual const char *get_name() const = 0;
+
+  /** Take a sample, and pass each metric to the sink. Collectors
+      that report rates will produce nothing the first time they are
+      called, because there is nothing to compare with. */
+  virtual void collect (MetricSink& sink) = 0;
+
+  protected:
+
+  /** Get the monotonic clock, in seconds, for working out rates. */
+  static double monotonic_seconds()
+    {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+  /** The increase in a counter, allowing for the counter having been
+      reset or wrapped round, in which case we report no increase. */
+  static uint64_t delta (uint64_t now, uint64_t before)
+    {
+    return now >= before ? now - before : 0;
+    }
+  };
+
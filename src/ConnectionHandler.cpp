@@ -18,47 +18,198 @@
 #include <proton/messaging_handler.hpp>
 #include <proton/sender_options.hpp>
 #include <proton/source_options.hpp>
+#include <proton/target.hpp>
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
 
+#include <stdlib.h>
+
 #include <iostream>
+#include <map>
 
 #include "QueueManager.h"
 #include "ConnectionHandler.h"
+#include "config.h"
 #include "logging.h"
 
-ConnectionHandler::ConnectionHandler (QueueManager& qm) : queue_manager(qm)
+/*=====================================================================
+
+  split_address
+
+  Split an address like "load?from=1234" into the queue name, which is
+  returned, and the options after the "?", which are separated by "&".
+
+=====================================================================*/
+static std::string split_address (const std::string &address, 
+       std::map<std::string, std::string> &options)
   {
+  size_t q = address.find ('?');
+  if (q == std::string::npos) return address;
+  size_t start = q + 1;
+  while (start <= address.size())
+    {
+    size_t end = address.find ('&', start);
+    if (end == std::string::npos) end = address.size();
+    std::string item = address.substr (start, end - start);
+    start = end + 1;
+    if (item.empty()) continue;
+    size_t eq = item.find ('=');
+    if (eq == std::string::npos)
+      options[item] = "";
+    else
+      options[item.substr (0, eq)] = item.substr (eq + 1);
+    }
+  return address.substr (0, q);
+  }
+
+/*=====================================================================
+
+  number_option
+
+  Get a numeric option from an address. Returns false if the option
+  is there, but isn't a number from min to max. If it isn't there, 
+  value is unchanged.
+
+=====================================================================*/
+static bool number_option (const std::map<std::string, std::string> &options,
+       const char *name, uint64_t min, uint64_t max, uint64_t &value)
+  {
+  std::map<std::string, std::string>::const_iterator i = 
+    options.find (name);
+  if (i == options.end()) return true;
+  char *end = 0;
+  uint64_t v = strtoull (i->second.c_str(), &end, 10);
+  if (i->second.empty() || *end != 0 || v < min || v > max) return false;
+  value = v;
+  return true;
+  }
+
+Pool<ConnectionHandler> ConnectionHandler::pool (CONNECTION_POOL_SIZE);
+
+ConnectionHandler::ConnectionHandler() : queue_manager(0)
+  {
+  }
+
+ConnectionHandler* ConnectionHandler::acquire (QueueManager& qm)
+  {
+  ConnectionHandler* h = pool.acquire();
+  h->queue_manager = &qm;
+  return h;
   }
 
 void ConnectionHandler::on_connection_open (proton::connection& c)
   {
-  DDBG (std::cout << "ConnectionHandler open connecton " << c 
-     << std::endl;)
+  DDBG (log << "ConnectionHandler open connecton " << c;)
   c.open(); 
   }
 
 void ConnectionHandler::on_sender_open (proton::sender &sender)
   {
-  DDBG (std::cout << "ConnectionHandler open sender " << sender 
-     << std::endl;)
-  std::string qn = sender.source().address();
-  DDBG (std::cout << "Sender's address is " << qn 
-     << std::endl;)
+  DDBG (log << "ConnectionHandler open sender " << sender;)
+  std::map<std::string, std::string> options;
+  std::string qn = split_address (sender.source().address(), options);
+  DDBG (log << "Sender's address is " << qn;)
+  // A client that is reconnecting can ask to resume from a sequence
+  //   number (message ID) with an address like "load?from=1234", 
+  //   giving the first message it has not seen, which it gets too
+  bool replay = false;
+  uint64_t replay_from = 0;
+  std::map<std::string, std::string>::iterator from = options.find ("from");
+  if (from != options.end())
+    {
+    char *end = 0;
+    replay_from = strtoull (from->second.c_str(), &end, 10);
+    if (from->second.empty() || *end != 0)
+      {
+      DWARN (log << "Invalid replay position: " << from->second;)
+      sender.close (proton::error_condition ("amqp:invalid-field",
+         "invalid replay position: " + from->second));
+      return;
+      }
+    replay = true;
+    }
+  // A client can ask for messages in batches, with an address like 
+  //   "cpu.#?batch=100&batch-us=50000"
+  uint64_t batch_size = 0, batch_us = DEFAULT_BATCH_US;
+  if (!number_option (options, "batch", 1, MAX_BATCH_SIZE, batch_size)
+       || !number_option (options, "batch-us", 1, 60000000, batch_us))
+    {
+    DWARN (log << "Invalid batch options in " << sender.source().address();)
+    sender.close (proton::error_condition ("amqp:invalid-field",
+       "invalid batch options"));
+    return;
+    }
   // Note that a sender is created with reference to the connection's
   //   list of all senders. Senders can thus remove themselves from the
   //   list when they are closed by Proton
-  Sender* s = new Sender (sender, senders);
+  // If the client supplied a message selector, compile it now. If it
+  //   won't compile, refuse the link.
+  Selector* selector = 0;
+  std::string selector_text;
+  if (Selector::find (sender.source().filters(), selector_text))
+    {
+    std::string error;
+    selector = Selector::compile (selector_text, error);
+    if (!selector)
+      {
+      DWARN (log << "Invalid selector \"" << selector_text << "\": " 
+         << error;)
+      sender.close (proton::error_condition ("amqp:invalid-field",
+         "invalid selector: " + error));
+      return;
+      }
+    DDBG (log << "Sender's selector is " << selector_text;)
+    }
+  // Ensure queue exists -- create it if not. This adds a user to the
+  //   Queue, which the Sender gives back when it is released.
+  Queue* q = queue_manager->find_queue (qn);
+  if (!q)
+    {
+    delete selector;
+    sender.close (proton::error_condition ("amqp:resource-limit-exceeded",
+       "too many queues"));
+    return;
+    }
+  Sender* s = Sender::acquire (sender, senders);
+  if (selector) s->set_selector (selector, sender.source().filters());
+  if (replay) s->set_replay_from (replay_from);
+  if (batch_size > 0) s->set_batching (batch_size, (int)batch_us);
   senders[sender] = s;
-  // Ensure queue exists -- create it if not
-  queue_manager.add (make_work (&QueueManager::find_queue_for_sender, 
-     &queue_manager, s, qn));
+  s->bind_to_queue (q, qn.empty() ? "__NONAME__" : qn);
+  }
+
+void ConnectionHandler::on_receiver_open (proton::receiver &receiver)
+  {
+  DDBG (log << "ConnectionHandler open receiver " << receiver;)
+  std::string qn = receiver.target().address();
+  if (!QueueManager::publishable (qn))
+    {
+    DWARN (log << "Client tried to publish to reserved or wildcard queue " 
+       << qn;)
+    receiver.close (proton::error_condition ("amqp:unauthorized-access",
+       "can't publish to queue: " + qn));
+    return;
+    }
+  // A named queue is kept while a client publishes to it, so that 
+  //   subscribers get its last values
+  Queue* q = 0;
+  if (!qn.empty())
+    {
+    q = queue_manager->find_queue (qn);
+    if (!q)
+      {
+      receiver.close (proton::error_condition 
+        ("amqp:resource-limit-exceeded", "too many queues"));
+      return;
+      }
+    }
+  receivers[receiver] = new Receiver (receiver, qn, q, *queue_manager, 
+    receivers);
   }
 
 void ConnectionHandler::on_session_close (proton::session &session)
   {
-  DDBG (std::cout << "ConnectionHandler close session " << session
-     << std::endl;)
+  DDBG (log << "ConnectionHandler close session " << session;)
   // Unsubscribe all senders in this session.
   for (proton::sender_iterator i = session.senders().begin(); 
         i != session.senders().end(); ++i) 
@@ -68,6 +219,7 @@ void ConnectionHandler::on_session_close (proton::session &session)
     SenderList::iterator j = senders.find(*i);
     if (j == senders.end()) continue;
     Sender* s = j->second;
+    s->disconnect();
     // If the sender has a queue, mark the sender unsubscribed
     //   from that queue
     if (s->get_queue()) 
@@ -79,36 +231,48 @@ void ConnectionHandler::on_session_close (proton::session &session)
     // Remove the session's sender from our list of senders
     senders.erase(j);
     }
+  for (proton::receiver_iterator i = session.receivers().begin(); 
+        i != session.receivers().end(); ++i) 
+    {
+    ReceiverList::iterator j = receivers.find(*i);
+    if (j == receivers.end()) continue;
+    delete j->second;
+    receivers.erase(j);
+    }
   }
 
 void ConnectionHandler::on_transport_close (proton::transport& t) 
   {
-  DDBG (std::cout << "ConnectionHandler transport closed " 
-    << t << std::endl;);
-  for (proton::sender_iterator i = t.connection().senders().begin(); 
-        i != t.connection().senders().end(); ++i) 
+  DDBG (log << "ConnectionHandler transport closed " << t;)
+  // Nothing more will run on this connection's work queue, so the 
+  //   Senders drop their links here, on our thread, and a Queue that
+  //   a Sender is subscribed to releases it, once it has unlinked it.
+  for (SenderList::iterator i = senders.begin(); i != senders.end(); ++i)
     {
-    // See if the transport's sender is in out list of senders
-    //   (but why should it not be?)
-    SenderList::iterator j = senders.find (*i);
-    if (j == senders.end()) return;
-    Sender* s = j->second;
-    // If the sender has a queue, mark the sender unsubscribed
-    //   from that queue
+    Sender* s = i->second;
+    s->disconnect();
     if (s->get_queue()) 
       {
-      // Schedule a call to Queue::unsubscribe
+      // Schedule a call to Queue::detach
       s->get_queue()->add_work 
-           (make_work (&Queue::unsubscribe, s->get_queue(), s));
+           (make_work (&Queue::detach, s->get_queue(), s));
       }
+    else
+      s->release();
     }
-  // Delete this object, as the client connection is gone
-  delete this; 
+  senders.clear();
+  for (ReceiverList::iterator i = receivers.begin(); 
+        i != receivers.end(); ++i)
+    delete i->second;
+  receivers.clear();
+  // Release this object, as the client connection is gone
+  queue_manager = 0;
+  pool.release (this);
   }
 
 void ConnectionHandler::on_error (const proton::error_condition& e)
   {
-  DERR (std::cout << "Protocol error: " << e.what() << std::endl;)
+  DERR (log << "Protocol error: " << e.what();)
   }
 
 
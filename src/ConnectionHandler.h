@@ -23,26 +23,34 @@
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
 
+#include "Pool.h"
 #include "QueueManager.h"
+#include "Receiver.h"
 #include "Sender.h"
 #include "SenderList.h"
 
 /** There is one instance of ConnectionHandler for each connection
     created by a client. Each instance is created by the ListenHandler
     when the container detects an incoming connection. When a 
-    client disconnects, the instance of ConnectionHandler deletes
-    itself. 
+    client disconnects, the instance of ConnectionHandler releases
+    itself, and any Senders it still has. ConnectionHandlers are 
+    pooled, like Senders, so a client that connects and disconnects
+    frequently does not keep allocating them. 
 
     ConnectionHandler is a subclass of proton::messaging_handler, 
     so it can be assigned as the handler for a proton::connection. */
 
-class ConnectionHandler : public proton::messaging_handler 
+class ConnectionHandler : public proton::messaging_handler, public Pooled
   {
+  friend class Pool<ConnectionHandler>;
+
   private:
 
-  /** A reference to the main queue manager, set when this 
-      object is constructed. */
-  QueueManager& queue_manager;
+  /** Released ConnectionHandlers, waiting to be reused. */
+  static Pool<ConnectionHandler> pool;
+
+  /** The main queue manager, set when this object is acquired. */
+  QueueManager* queue_manager;
 
   /** A mapping between proton::sender objects, and our
       Sender objects. This is maintained by the connection
@@ -50,11 +58,20 @@ class ConnectionHandler : public proton::messaging_handler
       and closed. */
   SenderList senders;
 
+  /** The links on which the client publishes messages. */
+  ReceiverList receivers;
+
+  ConnectionHandler();
+
   public:
 
-  /** Constructor takes a reference to the singleton QueueManager,
-      which is owner by the Server object. */
-  ConnectionHandler (QueueManager& qm);
+  /** Get a ConnectionHandler for a new connection, from the pool. 
+      The QueueManager is the singleton, which is owned by the Server
+      object. */
+  static ConnectionHandler* acquire (QueueManager& qm);
+
+  /** Get the pool, for its statistics. */
+  static const Pool<ConnectionHandler>& get_pool() { return pool; }
 
   private:
 
@@ -62,27 +79,34 @@ class ConnectionHandler : public proton::messaging_handler
       connection request. All we do is open the connection. */
   void on_connection_open (proton::connection& c) override; 
 
-  /** When a new sender (link) is opened by Proton, create
-      a new Sender wrapper object for it, then add it to
+  /** When a new sender (link) is opened by Proton, get
+      a Sender wrapper object for it, then add it to
       the list of known senders. Then ask the QueueManager
-      to create the new queue for the address specified
-      in the link. Then hander the Sender assign itself to be
-      the messaging_handler for the Proton sender object */
+      for the queue for the address specified in the link, 
+      creating it if necessary. Then have the Sender bind to the
+      queue, and assign itself to be the messaging_handler for 
+      the Proton sender object */
   void on_sender_open (proton::sender &sender) override;
 
+  /** When the client opens a link to publish messages, create a 
+      Receiver to handle it. The link's target address is the queue
+      to publish to; if it is empty, each message's "to" address is
+      used instead. */
+  void on_receiver_open (proton::receiver &receiver) override;
+
   /** Called when a session is closed on a specific client 
-      connection. Remove all senders associated with the
-      session from our internal state. */
+      connection. Remove all senders and receivers associated with 
+      the session from our internal state. */
   void on_session_close(proton::session &session) override;
 
   /** Called in response to a transport-level error. Just
       log the error message. */
   void on_error(const proton::error_condition& e) override;
 
-  /** Called when client connection closed. Remove any
-      senders associated with the connection from
-      out internal state, then delete
-      this instance, as it is no longer required. */
+  /** Called when client connection closed. Detach any
+      senders associated with the connection from their
+      queues, which releases them, delete any receivers, then 
+      release this instance, as it is no longer required. */
   void on_transport_close(proton::transport& t) override;
   };
 
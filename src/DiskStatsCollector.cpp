@@ -0,0 +1,98 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  DiskStatsCollector.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include "DiskStatsCollector.h"
+
+DiskStatsCollector::DiskStatsCollector() : 
+        file ("/proc/diskstats", 65536), last_time (0)
+  {
+  }
+
+DiskStatsCollector::Device& DiskStatsCollector::find (const char *name, 
+      size_t len)
+  {
+  for (size_t i = 0; i < devices.size(); i++)
+    {
+    if (devices[i].name.size() == len && 
+         devices[i].name.compare (0, len, name, len) == 0)
+      return devices[i];
+    }
+
+  // A new device. Dots in the name would look like extra levels in 
+  //   the queue name, so replace them.
+  static const char *suffixes[METRICS] = 
+    { "reads", "read_bytes", "writes", "write_bytes", "busy", 
+      "in_progress" };
+  static const char *units[METRICS] = 
+    { "/s", "B/s", "/s", "B/s", "%", "" };
+  Device d;
+  d.name.assign (name, len);
+  std::string n (d.name);
+  for (size_t i = 0; i < n.size(); i++)
+    if (n[i] == '.' || n[i] == '/') n[i] = '_';
+  for (int i = 0; i < METRICS; i++)
+    {
+    d.metrics[i] = Metric ("disk." + n + "." + suffixes[i], units[i]);
+    d.metrics[i].label ("device", d.name);
+    }
+  devices.push_back (d);
+  return devices.back();
+  }
+
+void DiskStatsCollector::collect (MetricSink& sink)
+  {
+  if (!file.read()) return;
+  double now = monotonic_seconds();
+  double dt = now - last_time;
+  bool primed = last_time > 0 && dt > 0;
+  ProcParser p (file);
+  do
+    {
+    // Each line is: major minor name, followed by the statistics
+    uint64_t major, minor;
+    const char *name;
+    size_t len;
+    if (!p.u64 (major) || !p.u64 (minor) || !p.token (name, len)) 
+      continue;
+    if ((len > 4 && memcmp (name, "loop", 4) == 0) || 
+        (len > 3 && memcmp (name, "ram", 3) == 0))
+      continue;
+
+    uint64_t f[11];
+    int n = 0;
+    while (n < 11 && p.u64 (f[n])) n++;
+    if (n < 11) continue;
+
+    Device& d = find (name, len);
+    // The fields are: reads, reads merged, sectors read, ms reading,
+    //   writes, writes merged, sectors written, ms writing, I/Os in
+    //   progress, ms doing I/O, weighted ms doing I/O. Sectors are
+    //   always 512 bytes here, whatever the device.
+    if (primed)
+      {
+      sink.metric (d.metrics[READS].set (delta (f[0], d.reads) / dt));
+      sink.metric (d.metrics[READ_BYTES].set 
+        (delta (f[2], d.sectors_read) * 512.0 / dt));
+      sink.metric (d.metrics[WRITES].set (delta (f[4], d.writes) / dt));
+      sink.metric (d.metrics[WRITE_BYTES].set 
+        (delta (f[6], d.sectors_written) * 512.0 / dt));
+      double busy = delta (f[9], d.io_ms) / (dt * 10.0);
+      sink.metric (d.metrics[BUSY].set (busy > 100 ? 100 : busy));
+      sink.metric (d.metrics[IN_PROGRESS].set ((double)f[8]));
+      }
+    d.reads = f[0];
+    d.sectors_read = f[2];
+    d.writes = f[4];
+    d.sectors_written = f[6];
+    d.io_ms = f[9];
+    } while (p.next_line());
+  last_time = now;
+  }
+
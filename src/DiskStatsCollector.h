@@ -0,0 +1,58 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  DiskStatsCollector.h
+
+  Collects block device activity from /proc/diskstats. For each 
+  device there are disk.DEV.reads and disk.DEV.writes (operations 
+  per second), disk.DEV.read_bytes and disk.DEV.write_bytes (bytes
+  per second), disk.DEV.busy (percentage of time with I/O in 
+  progress) and disk.DEV.in_progress (current I/O operations). Loop
+  and RAM disk devices are ignored.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <vector>
+
+#include "Collector.h"
+#include "ProcFile.h"
+
+class DiskStatsCollector : public Collector
+  {
+  private:
+
+  enum { READS, READ_BYTES, WRITES, WRITE_BYTES, BUSY, IN_PROGRESS, 
+    METRICS };
+
+  class Device
+    {
+    public:
+    std::string name;
+    Metric metrics[METRICS];
+    uint64_t reads, sectors_read, writes, sectors_written, io_ms;
+    Device() : reads (0), sectors_read (0), writes (0), 
+      sectors_written (0), io_ms (0) {}
+    };
+
+  ProcFile file;
+  std::vector<Device> devices;
+  double last_time;
+
+  /** Find the device with the given name, creating it if it isn't 
+      known yet. */
+  Device& find (const char *name, size_t len);
+
+  public:
+
+  DiskStatsCollector();
+
+  const char *get_name() const override { return "diskstats"; }
+
+  void collect (MetricSink& sink) override;
+  };
+
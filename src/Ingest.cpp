@@ -0,0 +1,167 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Ingest.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+
+#include "config.h"
+#include "Ingest.h"
+#include "Server.h"
+#include "Stats.h"
+#include "logging.h"
+
+Ingest::Ingest (Server *server, int fd, const std::string &path)
+    : server (server), fd (fd), path (path)
+  {
+  }
+
+Ingest::~Ingest()
+  {
+  close (fd);
+  unlink (path.c_str());
+  }
+
+/*=====================================================================
+
+  open
+
+=====================================================================*/
+Ingest *Ingest::open (Server *server, const std::string &path,
+     std::string &error)
+  {
+  struct sockaddr_un addr;
+  if (path.empty() || path.size() >= sizeof (addr.sun_path))
+    {
+    error = "invalid socket path";
+    return 0;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path.c_str());
+
+  int fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+    error = strerror (errno);
+    return 0;
+    }
+
+  // A socket left behind by an earlier run would stop bind() working.
+  //   Don't remove anything that isn't a socket, though.
+  struct stat sb;
+  if (lstat (path.c_str(), &sb) == 0 && S_ISSOCK (sb.st_mode))
+    unlink (path.c_str());
+
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) != 0)
+    {
+    error = strerror (errno);
+    close (fd);
+    return 0;
+    }
+
+  // A bigger buffer rides out bursts, while we're busy publishing. 
+  //   The kernel may limit it, but that isn't an error
+  int size = INGEST_SOCKET_BUFFER;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+  DINFO (log << "Ingesting messages on " << path;)
+  return new Ingest (server, fd, path);
+  }
+
+/*=====================================================================
+
+  publish
+
+=====================================================================*/
+void Ingest::publish (const unsigned char *data, size_t length)
+  {
+  size_t i = 0;
+  while (i < length)
+    {
+    if (length - i < 3)
+      {
+      DDBG (log << "Malformed ingest record";)
+      Stats::count (Stats::INGEST_REJECTED);
+      break;
+      }
+    size_t q = data[i];
+    size_t n = ((size_t)data[i + 1] << 8) | data[i + 2];
+    i += 3;
+    if (q == 0 || length - i < q + n)
+      {
+      DDBG (log << "Malformed ingest record";)
+      Stats::count (Stats::INGEST_REJECTED);
+      break;
+      }
+    std::string name ((const char *)data + i, q);
+    i += q;
+    if (!QueueManager::publishable (name))
+      {
+      DDBG (log << "Ingest record for reserved or wildcard queue " 
+         << name;)
+      Stats::count (Stats::INGEST_REJECTED);
+      }
+    else
+      {
+      Stats::count (Stats::INGESTED);
+      server->publish (name, std::string ((const char *)data + i, n));
+      }
+    i += n;
+    }
+  }
+
+/*=====================================================================
+
+  run
+
+=====================================================================*/
+void Ingest::run()
+  {
+  std::vector<unsigned char> buffers (INGEST_BATCH * INGEST_DATAGRAM_SIZE);
+  struct mmsghdr msgs[INGEST_BATCH];
+  struct iovec iovs[INGEST_BATCH];
+  for (;;)
+    {
+    memset (msgs, 0, sizeof (msgs));
+    for (int i = 0; i < INGEST_BATCH; i++)
+      {
+      iovs[i].iov_base = &buffers[i * INGEST_DATAGRAM_SIZE];
+      iovs[i].iov_len = INGEST_DATAGRAM_SIZE;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+    // Wait for at least one datagram, then take as many as are there
+    int n = recvmmsg (fd, msgs, INGEST_BATCH, MSG_WAITFORONE, 0);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      DERR (log << "Ingest socket error: " << strerror (errno);)
+      return;
+      }
+    for (int i = 0; i < n; i++)
+      {
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+        DDBG (log << "Ingest datagram too long";)
+        Stats::count (Stats::INGEST_REJECTED);
+        continue;
+        }
+      publish ((const unsigned char *)iovs[i].iov_base, msgs[i].msg_len);
+      }
+    }
+  }
+
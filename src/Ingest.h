@@ -0,0 +1,68 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Ingest.h
+
+  Ingest receives messages from other processes on the same host, on
+  a Unix-domain datagram socket, and publishes them, exactly as if 
+  they had been published by the monitor thread. This is much cheaper
+  for the sender than an AMQP connection, and it can send many 
+  messages in one datagram.
+
+  A datagram contains one or more records, one after the other. Each
+  record is:
+
+  1 byte   length of the queue name, q (1-255)
+  2 bytes  length of the message text, n, most significant byte first
+  q bytes  queue name
+  n bytes  message text
+
+  Ingest reads up to INGEST_BATCH datagrams with each system call. 
+  A record whose lengths run past the end of its datagram ends the
+  datagram -- the records before it are still published. Records for
+  queues whose names start with "$sys." are rejected: those queues 
+  belong to the server.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+
+class Server;
+
+class Ingest
+  {
+  private:
+
+  Server *server;
+
+  int fd;
+
+  std::string path;
+
+  Ingest (Server *server, int fd, const std::string &path);
+
+  /** Publish the records in one datagram. */
+  void publish (const unsigned char *data, size_t length);
+
+  public:
+
+  ~Ingest();
+
+  /** Create the socket at path, replacing any socket that is there 
+      already. Returns null, and sets error, if the socket can't be 
+      created. */
+  static Ingest *open (Server *server, const std::string &path, 
+      std::string &error);
+
+  /** Receive and publish messages. This only returns if the socket
+      fails, so it needs a thread of its own. */
+  void run();
+  };
+
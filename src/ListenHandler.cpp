@@ -37,20 +37,20 @@ ListenHandler::ListenHandler (QueueManager& c) : queue_manager(c)
     -- that will be associated with the new connection. */
 proton::connection_options ListenHandler::on_accept (proton::listener&)
   {
-  DDBG (std::cout << "Connection accepted" << std::endl;)
+  DDBG (log << "Connection accepted";)
   proton::connection_options co;
-  co.handler (*(new ConnectionHandler (queue_manager)));
+  co.handler (*ConnectionHandler::acquire (queue_manager));
   return co;
   }
 
 void ListenHandler::on_open (proton::listener& l) 
   {
-  DINFO (std::cout << "Server listening on port " << l.port() << std::endl;)
+  DINFO (log << "Server listening on port " << l.port();)
   }
 
 void ListenHandler::on_error (proton::listener&, const std::string& s) 
   {
-  DERR (std::cerr << "Listener error: " << s << std::endl;)
+  DERR (log << "Listener error: " << s;)
   exit (1); // The listener is running on a separate thread so, if
             //   an exception is thrown from here, it won't be caught.
   }
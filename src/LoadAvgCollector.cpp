@@ -0,0 +1,30 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  LoadAvgCollector.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <stdlib.h>
+
+#include "LoadAvgCollector.h"
+#include "config.h"
+
+LoadAvgCollector::LoadAvgCollector()
+  {
+  metrics[0].name = LOADAVG_METRIC ".1";
+  metrics[1].name = LOADAVG_METRIC ".5";
+  metrics[2].name = LOADAVG_METRIC ".15";
+  }
+
+void LoadAvgCollector::collect (MetricSink& sink)
+  {
+  double load[3];
+  int n = getloadavg (load, 3);
+  for (int i = 0; i < n; i++)
+    sink.metric (metrics[i].set (load[i]));
+  }
+
@@ -0,0 +1,32 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  LoadAvgCollector.h
+
+  Collects the 1, 5 and 15 minute load averages, as the metrics
+  loadavg.1, loadavg.5 and loadavg.15.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include "Collector.h"
+
+class LoadAvgCollector : public Collector
+  {
+  private:
+
+  Metric metrics[3];
+
+  public:
+
+  LoadAvgCollector();
+
+  const char *get_name() const override { return "loadavg"; }
+
+  void collect (MetricSink& sink) override;
+  };
+
@@ -0,0 +1,209 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Logger.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "Logger.h"
+
+/** How often the writer thread looks for records, in msec. */
+#define LOG_WRITE_INTERVAL 20
+
+/*=====================================================================
+
+  LogRing is one thread's ring of records. Only the owning thread 
+  writes records, and only the writer thread (holding write_lock) 
+  reads them, so head and tail are the only shared state.
+
+=====================================================================*/
+class LogRing
+  {
+  public:
+  LogEntry entries[LOG_RING_SIZE];
+  /** The number of records ever added, written by the owner. */
+  std::atomic<uint64_t> head;
+  /** The number of records ever taken, written by the writer. */
+  std::atomic<uint64_t> tail;
+  /** Records dropped because the ring was full. */
+  std::atomic<uint64_t> dropped;
+  /** Set while a thread owns this ring. A thread that starts after 
+      another has finished takes over its ring. */
+  std::atomic<bool> owned;
+  LogRing *next;
+  LogRing() : head (0), tail (0), dropped (0), owned (true), next (0) {}
+  };
+
+/** All the rings. New rings are pushed on the front. They are never
+    removed, but they are reused. */
+static std::atomic<LogRing*> rings (0);
+
+/** Held while taking records from the rings and writing them, so 
+    that flush() and the writer thread don't interleave. */
+static std::mutex write_lock;
+
+static const char *level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+/*=====================================================================
+
+  write_entry
+
+=====================================================================*/
+static void write_entry (const LogEntry &e)
+  {
+  struct tm tm;
+  localtime_r (&e.time.tv_sec, &tm);
+  char stamp[32];
+  strftime (stamp, sizeof (stamp), "%Y-%m-%d %H:%M:%S", &tm);
+  int level = e.level < 0 ? 0 : e.level > 3 ? 3 : e.level;
+  fprintf (stdout, "%s.%06ld %s %.*s\n", stamp, e.time.tv_nsec / 1000, 
+    level_names[level], (int)e.length, e.text);
+  }
+
+static bool before (const struct timespec &a, const struct timespec &b)
+  {
+  return a.tv_sec < b.tv_sec 
+    || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+  }
+
+/*=====================================================================
+
+  drain
+
+  Take every record from every ring, and write it to stdout. Records
+  from different threads are merged, so that they come out in time
+  order. The caller must hold write_lock.
+
+=====================================================================*/
+static void drain()
+  {
+  for (;;)
+    {
+    LogRing *oldest = 0;
+    for (LogRing *r = rings.load(); r; r = r->next)
+      {
+      uint64_t tail = r->tail.load (std::memory_order_relaxed);
+      if (tail == r->head.load (std::memory_order_acquire)) continue;
+      if (!oldest || before (r->entries[tail % LOG_RING_SIZE].time, 
+            oldest->entries[oldest->tail % LOG_RING_SIZE].time))
+        oldest = r;
+      }
+    if (!oldest) break;
+    uint64_t tail = oldest->tail.load (std::memory_order_relaxed);
+    write_entry (oldest->entries[tail % LOG_RING_SIZE]);
+    oldest->tail.store (tail + 1, std::memory_order_release);
+    }
+
+  for (LogRing *r = rings.load(); r; r = r->next)
+    {
+    uint64_t dropped = r->dropped.exchange (0);
+    if (dropped > 0)
+      fprintf (stdout, "WARN %llu log record(s) dropped\n", 
+        (unsigned long long)dropped);
+    }
+  fflush (stdout);
+  }
+
+/*=====================================================================
+
+  writer
+
+  The writer thread.
+
+=====================================================================*/
+static void writer()
+  {
+  for (;;)
+    {
+    std::this_thread::sleep_for 
+      (std::chrono::milliseconds (LOG_WRITE_INTERVAL));
+    std::lock_guard<std::mutex> l (write_lock);
+    drain();
+    }
+  }
+
+static void flush_at_exit()
+  {
+  Logger::flush();
+  }
+
+/*=====================================================================
+
+  ring
+
+  Get the calling thread's ring, creating it the first time, and 
+  starting the writer thread if this is the first ring.
+
+=====================================================================*/
+static LogRing *ring()
+  {
+  // The Owner gives up the ring when the thread finishes
+  static thread_local class Owner
+    {
+    public:
+    LogRing *r;
+    Owner() : r (0) {}
+    ~Owner() { if (r) r->owned = false; }
+    } owner;
+  if (owner.r) return owner.r;
+
+  for (LogRing *r = rings.load(); r; r = r->next)
+    {
+    bool owned = false;
+    if (r->owned.compare_exchange_strong (owned, true))
+      return owner.r = r;
+    }
+
+  LogRing *r = new LogRing();
+  LogRing *head = rings.load();
+  do
+    r->next = head;
+  while (!rings.compare_exchange_weak (head, r));
+
+  static std::once_flag started;
+  std::call_once (started, [] 
+    { 
+    std::thread (writer).detach(); 
+    atexit (flush_at_exit);
+    });
+  return owner.r = r;
+  }
+
+void Logger::submit (const LogEntry &e)
+  {
+  LogRing *r = ring();
+  uint64_t head = r->head.load (std::memory_order_relaxed);
+  if (head - r->tail.load (std::memory_order_acquire) >= LOG_RING_SIZE)
+    {
+    r->dropped++;
+    return;
+    }
+  LogEntry &slot = r->entries[head % LOG_RING_SIZE];
+  slot.time = e.time;
+  slot.level = e.level;
+  slot.length = e.length;
+  memcpy (slot.text, e.text, e.length);
+  r->head.store (head + 1, std::memory_order_release);
+  }
+
+void Logger::flush()
+  {
+  std::lock_guard<std::mutex> l (write_lock);
+  drain();
+  }
+
+LogRecord::~LogRecord()
+  {
+  Logger::submit (entry);
+  }
+
@@ -0,0 +1,152 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Logger.h
+
+  The back end of the logging macros in logging.h. Writing a log 
+  message to stdout from a Proton thread would make that thread wait
+  for the stdout lock, and for the write itself, and every other 
+  thread that logs would queue up behind it. So a log message is 
+  formatted by the thread that logs it into a LogRecord, on the 
+  stack, and then copied into a ring buffer that belongs to that 
+  thread. A background thread takes the records from all the rings, 
+  and writes them out. Nothing on the logging thread locks, allocates
+  memory (for the usual types), or makes a system call, except to 
+  read the clock.
+
+  If a thread logs faster than the writer can keep up, and its ring
+  fills, further records are dropped, and counted, rather than making
+  the thread wait. The writer reports how many were dropped.
+
+  Each record carries the time it was made, and its level. Besides 
+  text, a record can carry structured fields, which are written as
+  key=value after the text, so they're easy to pick out with tools
+  like grep and awk.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <ostream>
+#include <sstream>
+#include <string>
+
+/** The longest log message, in bytes. Longer messages are 
+    truncated. */
+#define LOG_RECORD_SIZE 256
+
+/** The number of records in each thread's ring. */
+#define LOG_RING_SIZE 512
+
+/** One log message, as it is held in a ring. */
+class LogEntry
+  {
+  public:
+  struct timespec time;
+  int level;
+  size_t length;
+  char text[LOG_RECORD_SIZE];
+  };
+
+/** A LogRecord is a log message being built. The logging macros 
+    create one, on the stack, called "log", and the message is 
+    written to it with <<. When it goes out of scope, it is handed to
+    the Logger. */
+class LogRecord
+  {
+  private:
+
+  LogEntry entry;
+
+  void append (const char *s, size_t n)
+    {
+    size_t room = LOG_RECORD_SIZE - entry.length;
+    if (n > room) n = room;
+    memcpy (entry.text + entry.length, s, n);
+    entry.length += n;
+    }
+
+  template <class T> LogRecord& format (const char *fmt, T t)
+    {
+    char s[32];
+    int n = snprintf (s, sizeof (s), fmt, t);
+    if (n > 0) append (s, (size_t)n < sizeof (s) ? n : sizeof (s) - 1);
+    return *this;
+    }
+
+  public:
+
+  LogRecord (int level)
+    {
+    clock_gettime (CLOCK_REALTIME, &entry.time);
+    entry.level = level;
+    entry.length = 0;
+    }
+
+  ~LogRecord();
+
+  LogRecord& operator<< (const char *s) { append (s, strlen (s)); return *this; }
+  /** Without this, strerror() and the like would match the pointer
+      template below, and be written as addresses. */
+  LogRecord& operator<< (char *s) { return *this << (const char *)s; }
+  LogRecord& operator<< (const std::string &s) 
+    { 
+    append (s.data(), s.size()); 
+    return *this; 
+    }
+  LogRecord& operator<< (char c) { append (&c, 1); return *this; }
+  LogRecord& operator<< (bool b) { return *this << (b ? "true" : "false"); }
+  LogRecord& operator<< (int i) { return format ("%d", i); }
+  LogRecord& operator<< (unsigned int i) { return format ("%u", i); }
+  LogRecord& operator<< (long i) { return format ("%ld", i); }
+  LogRecord& operator<< (unsigned long i) { return format ("%lu", i); }
+  LogRecord& operator<< (long long i) { return format ("%lld", i); }
+  LogRecord& operator<< (unsigned long long i) { return format ("%llu", i); }
+  LogRecord& operator<< (double d) { return format ("%g", d); }
+  template <class T> LogRecord& operator<< (T *p) 
+    { 
+    return format ("%p", (const void *)p); 
+    }
+
+  /** Anything else that can be written to a std::ostream -- Proton 
+      objects, for example. This allocates, so it's not for hot 
+      paths. */
+  template <class T> LogRecord& operator<< (const T &t)
+    {
+    std::ostringstream s;
+    s << t;
+    return *this << s.str();
+    }
+
+  /** Manipulators, like std::endl, are ignored: each record is one
+      line. */
+  LogRecord& operator<< (std::ostream& (*)(std::ostream&)) { return *this; }
+
+  /** Add a structured field, which is written as " key=value". */
+  template <class T> LogRecord& field (const char *key, const T &value)
+    {
+    return *this << ' ' << key << '=' << value;
+    }
+  };
+
+class Logger
+  {
+  public:
+
+  /** Copy a record into the calling thread's ring. */
+  static void submit (const LogEntry &e);
+
+  /** Write out everything that has been logged so far, by all 
+      threads, before returning. This is thread-safe. */
+  static void flush();
+  };
+
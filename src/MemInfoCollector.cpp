@@ -0,0 +1,62 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  MemInfoCollector.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include "MemInfoCollector.h"
+
+/** The /proc/meminfo keys we report, and the metric names. The first
+    three must stay first, because we use them to work out 
+    mem.used_percent. */
+static const struct { const char *key; const char *name; } keys[] =
+  {
+  {"MemTotal", "mem.total"},
+  {"MemFree", "mem.free"},
+  {"MemAvailable", "mem.available"},
+  {"Buffers", "mem.buffers"},
+  {"Cached", "mem.cached"},
+  {"Dirty", "mem.dirty"},
+  {"SwapTotal", "mem.swap_total"},
+  {"SwapFree", "mem.swap_free"},
+  {0, 0}
+  };
+
+MemInfoCollector::MemInfoCollector() : 
+        file ("/proc/meminfo"), used ("mem.used_percent", "%")
+  {
+  for (int i = 0; keys[i].key; i++)
+    metrics.push_back (Metric (keys[i].name, "B"));
+  }
+
+void MemInfoCollector::collect (MetricSink& sink)
+  {
+  if (!file.read()) return;
+  double values[3] = {0, 0, 0};
+  ProcParser p (file);
+  do
+    {
+    const char *s;
+    size_t len;
+    if (!p.token (s, len)) continue;
+    for (int i = 0; keys[i].key; i++)
+      {
+      if (strlen (keys[i].key) != len || memcmp (s, keys[i].key, len) != 0)
+        continue;
+      uint64_t kb;
+      if (!p.u64 (kb)) break;
+      double bytes = kb * 1024.0;
+      sink.metric (metrics[i].set (bytes));
+      if (i < 3) values[i] = bytes;
+      break;
+      }
+    } while (p.next_line());
+
+  if (values[0] > 0)
+    sink.metric (used.set (100.0 * (values[0] - values[2]) / values[0]));
+  }
+
@@ -0,0 +1,41 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  MemInfoCollector.h
+
+  Collects memory usage from /proc/meminfo. The metrics are 
+  mem.total, mem.free, mem.available, mem.buffers, mem.cached,
+  mem.dirty, mem.swap_total and mem.swap_free, all in bytes, and
+  mem.used_percent, which is the percentage of memory that is not
+  available.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include "Collector.h"
+#include "ProcFile.h"
+
+class MemInfoCollector : public Collector
+  {
+  private:
+
+  ProcFile file;
+
+  /** Metrics, in the same order as the keys in the .cpp file */
+  std::vector<Metric> metrics;
+
+  Metric used;
+
+  public:
+
+  MemInfoCollector();
+
+  const char *get_name() const override { return "meminfo"; }
+
+  void collect (MetricSink& sink) override;
+  };
+
@@ -0,0 +1,98 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Metric.h
+
+  A Metric is one sample of a measurement: its name, which is also 
+  the queue it is published to, its value and unit, when it was 
+  taken, and labels that say what it applies to -- a disk, or a 
+  network interface, for example.
+
+  Metrics are published with a structured body, an AMQP list, so 
+  that consumers get the value, unit, and time without parsing 
+  anything:
+
+  [name (string), value (double), unit (symbol), 
+   monotonic time (long, ns), wall time (timestamp, ms), 
+   labels (map of string to string)]
+
+  A list is more compact than a map, because the field names aren't
+  repeated in every message. The value, and the labels, are also 
+  put in the application properties, so that clients can use 
+  selectors on them.
+
+  A Collector keeps a Metric for each thing it measures, and reuses 
+  it for every sample, so the name, unit and labels are built once.
+  The Metric also keeps the unit as an AMQP symbol, and the labels as
+  message properties, so publishing a sample doesn't convert them 
+  again. So a Metric must only be published by one thread at a time.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <proton/message.hpp>
+#include <proton/symbol.hpp>
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Labels are name-value pairs, kept in the order they were added. 
+    There are only ever a few, so a vector is quicker than a map. */
+typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+class Metric
+  {
+  public:
+
+  std::string name;
+  double value;
+  std::string unit;
+  /** When the sample was taken, in nanoseconds on the monotonic 
+      clock, for working out intervals. */
+  int64_t monotonic;
+  /** When the sample was taken, in milliseconds since the epoch. */
+  int64_t wall;
+  Labels labels;
+  /** The unit, ready to encode. */
+  proton::symbol unit_symbol;
+  /** The labels, as message properties. */
+  proton::message::property_map properties;
+
+  Metric() : value (0), monotonic (0), wall (0) 
+    {
+    }
+
+  Metric (const std::string& n, const std::string& u) : name (n), 
+      value (0), unit (u), monotonic (0), wall (0), unit_symbol (u)
+    {
+    }
+
+  /** Add a label. */
+  Metric& label (const std::string& n, const std::string& v)
+    {
+    labels.push_back (std::make_pair (n, v));
+    properties.put (n, v);
+    return *this;
+    }
+
+  /** Set the value, and the time to now. */
+  Metric& set (double v)
+    {
+    struct timespec ts;
+    value = v;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    monotonic = ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    wall = ts.tv_sec * (int64_t)1000 + ts.tv_nsec / 1000000;
+    return *this;
+    }
+  };
+
@@ -0,0 +1,86 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  NetDevCollector.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include "NetDevCollector.h"
+
+NetDevCollector::NetDevCollector() : 
+        file ("/proc/net/dev", 65536), last_time (0)
+  {
+  }
+
+NetDevCollector::Interface& NetDevCollector::find (const char *name, 
+      size_t len)
+  {
+  for (size_t i = 0; i < interfaces.size(); i++)
+    {
+    if (interfaces[i].name.size() == len && 
+         interfaces[i].name.compare (0, len, name, len) == 0)
+      return interfaces[i];
+    }
+
+  // A new interface. Dots in the name (as in VLAN interfaces like
+  //   eth0.100) would look like extra levels in the queue name, so 
+  //   replace them.
+  static const char *suffixes[METRICS] = 
+    { "rx_bytes", "rx_packets", "rx_errors", "rx_dropped", 
+      "tx_bytes", "tx_packets", "tx_errors", "tx_dropped" };
+  static const char *units[METRICS] = 
+    { "B/s", "/s", "/s", "/s", "B/s", "/s", "/s", "/s" };
+  Interface f;
+  f.name.assign (name, len);
+  std::string n (f.name);
+  for (size_t i = 0; i < n.size(); i++)
+    if (n[i] == '.') n[i] = '_';
+  for (int i = 0; i < METRICS; i++)
+    {
+    f.metrics[i] = Metric ("net." + n + "." + suffixes[i], units[i]);
+    f.metrics[i].label ("interface", f.name);
+    }
+  interfaces.push_back (f);
+  return interfaces.back();
+  }
+
+void NetDevCollector::collect (MetricSink& sink)
+  {
+  if (!file.read()) return;
+  double now = monotonic_seconds();
+  double dt = now - last_time;
+  bool primed = last_time > 0 && dt > 0;
+  ProcParser p (file);
+  // The first two lines are headings
+  if (!p.next_line() || !p.next_line()) return;
+  do
+    {
+    const char *name;
+    size_t len;
+    if (!p.token (name, len)) continue;
+
+    // The fields are: receive bytes, packets, errs, drop, fifo, frame,
+    //   compressed, multicast; then transmit bytes, packets, errs, 
+    //   drop, fifo, colls, carrier, compressed.
+    uint64_t f[16];
+    int n = 0;
+    while (n < 16 && p.u64 (f[n])) n++;
+    if (n < 12) continue;
+    uint64_t values[METRICS] = 
+      { f[0], f[1], f[2], f[3], f[8], f[9], f[10], f[11] };
+
+    Interface& iface = find (name, len);
+    for (int i = 0; i < METRICS; i++)
+      {
+      if (primed)
+        sink.metric (iface.metrics[i].set 
+          (delta (values[i], iface.counters[i]) / dt));
+      iface.counters[i] = values[i];
+      }
+    } while (p.next_line());
+  last_time = now;
+  }
+
@@ -0,0 +1,56 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  NetDevCollector.h
+
+  Collects network interface traffic from /proc/net/dev. For each 
+  interface there are net.IF.rx_bytes, net.IF.tx_bytes, 
+  net.IF.rx_packets, net.IF.tx_packets, net.IF.rx_errors, 
+  net.IF.tx_errors, net.IF.rx_dropped and net.IF.tx_dropped, all 
+  per second.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <vector>
+
+#include "Collector.h"
+#include "ProcFile.h"
+
+class NetDevCollector : public Collector
+  {
+  private:
+
+  enum { RX_BYTES, RX_PACKETS, RX_ERRORS, RX_DROPPED, 
+    TX_BYTES, TX_PACKETS, TX_ERRORS, TX_DROPPED, METRICS };
+
+  class Interface
+    {
+    public:
+    std::string name;
+    Metric metrics[METRICS];
+    uint64_t counters[METRICS];
+    Interface() { for (int i = 0; i < METRICS; i++) counters[i] = 0; }
+    };
+
+  ProcFile file;
+  std::vector<Interface> interfaces;
+  double last_time;
+
+  /** Find the interface with the given name, creating it if it isn't
+      known yet. */
+  Interface& find (const char *name, size_t len);
+
+  public:
+
+  NetDevCollector();
+
+  const char *get_name() const override { return "netdev"; }
+
+  void collect (MetricSink& sink) override;
+  };
+
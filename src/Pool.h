@@ -0,0 +1,115 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Pool.h
+
+  A Pool keeps objects that are no longer in use, so they can be 
+  used again, rather than freed and allocated. Senders and 
+  ConnectionHandlers are pooled, because short-lived clients -- 
+  health checks, for example -- create and discard them at a high 
+  rate. A pooled object also keeps the buffers it has allocated, so
+  reusing it does not allocate those again either.
+
+  Each object in a Pool has a generation number, which changes every
+  time the object is released. A work item that was scheduled while
+  the object had one owner can record the generation, and check it
+  when it runs: if it has changed, the object now belongs to someone
+  else, and the work item must leave it alone.
+
+  A Pool is thread-safe: objects are often acquired on one thread, 
+  and released on another. The lock is held only to take an object 
+  from, or put one on, the free list. Pooled objects are never freed,
+  so a work item that checks the generation of an object that has 
+  been released always reads a live object of the same type. The 
+  pool grows to the most objects that have been in use at once.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/** The base class of objects that can be kept in a Pool. */
+class Pooled
+  {
+  private:
+
+  std::atomic<uint32_t> generation;
+
+  template <class T> friend class Pool;
+
+  public:
+
+  Pooled() : generation (0) {}
+
+  /** Get the generation number. This method is thread-safe. */
+  uint32_t get_generation() const 
+    { 
+    return generation.load (std::memory_order_acquire); 
+    }
+  };
+
+template <class T> class Pool
+  {
+  private:
+
+  std::mutex lock;
+
+  /** Objects that are not in use. */
+  std::vector<T*> free;
+
+  std::atomic<unsigned long> created;
+  std::atomic<unsigned long> reused;
+
+  public:
+
+  /** Make a Pool with room for n objects on the free list to start 
+      with. */
+  Pool (size_t n) : created (0), reused (0)
+    {
+    free.reserve (n);
+    }
+
+  /** Get an object from the free list, or create one if the free 
+      list is empty. The caller must initialize the object. */
+  T* acquire()
+    {
+      {
+      std::lock_guard<std::mutex> l (lock);
+      if (!free.empty())
+        {
+        T* t = free.back();
+        free.pop_back();
+        reused++;
+        return t;
+        }
+      }
+    created++;
+    return new T();
+    }
+
+  /** Return an object to the free list, changing its generation. The
+      caller must already have released anything the object refers 
+      to. */
+  void release (T* t)
+    {
+    t->generation.fetch_add (1, std::memory_order_release);
+    std::lock_guard<std::mutex> l (lock);
+    free.push_back (t);
+    }
+
+  /** The number of objects created, since the program started. */
+  unsigned long get_created() const { return created; }
+
+  /** The number of times an object was reused, rather than 
+      created. */
+  unsigned long get_reused() const { return reused; }
+  };
+
@@ -0,0 +1,63 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ProcFile.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "ProcFile.h"
+#include "logging.h"
+
+ProcFile::ProcFile (const std::string& p, size_t buffer_size) :
+        path (p), buffer (buffer_size + 1), length (0)
+  {
+  fd = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    DWARN (log << "Can't open " << path << ": " 
+       << strerror (errno);)
+  buffer[0] = 0;
+  }
+
+ProcFile::~ProcFile()
+  {
+  if (fd >= 0) close (fd);
+  }
+
+bool ProcFile::read()
+  {
+  length = 0;
+  buffer[0] = 0;
+  if (fd < 0) return false;
+  // Files in /proc are generated as they are read, and a single read
+  //   might not return all of it.
+  size_t capacity = buffer.size() - 1;
+  while (length < capacity)
+    {
+    ssize_t n = pread (fd, &buffer[length], capacity - length, length);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      return false;
+      }
+    if (n == 0) break;
+    length += n;
+    }
+  if (length == capacity)
+    {
+    // The buffer is full, so the last line might be incomplete
+    while (length > 0 && buffer[length - 1] != '\n') length--;
+    }
+  buffer[length] = 0;
+  return true;
+  }
+
@@ -0,0 +1,166 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ProcFile.h
+
+  ProcFile reads a file in /proc repeatedly, without allocating memory
+  or reopening the file each time. The file is opened once, and each
+  read() is a pread() from offset zero into a buffer that was
+  allocated when the ProcFile was created.
+
+  ProcParser is a cursor over the text that ProcFile reads. It splits
+  the text into lines and whitespace-separated tokens, and parses
+  numbers, without copying anything.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+class ProcFile
+  {
+  private:
+
+  std::string path;
+  int fd;
+  std::vector<char> buffer;
+  size_t length;
+
+  public:
+
+  /** Open the file. The buffer must be large enough to hold the whole
+      file -- if it isn't, the text is truncated at the last complete
+      line. */
+  ProcFile (const std::string& path, size_t buffer_size = 16384);
+
+  ~ProcFile();
+
+  /** Returns true if the file was opened successfully. */
+  bool is_open() const { return fd >= 0; }
+
+  /** Re-read the file. Returns false on error. After a successful
+      read, data() is NUL-terminated. */
+  bool read();
+
+  const char *data() const { return &buffer[0]; }
+  size_t size() const { return length; }
+  const std::string& get_path() const { return path; }
+
+  private:
+  ProcFile (const ProcFile&);
+  ProcFile& operator= (const ProcFile&);
+  };
+
+class ProcParser
+  {
+  private:
+
+  const char *p;
+  const char *end;
+
+  void skip_blanks()
+    {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    }
+
+  public:
+
+  ProcParser (const char *data, size_t length) : 
+      p (data), end (data + length) 
+    {
+    }
+
+  ProcParser (const ProcFile& f) : p (f.data()), end (f.data() + f.size())
+    {
+    }
+
+  /** Returns true if there is no more text. */
+  bool at_end() const { return p >= end; }
+
+  /** Returns true if the cursor is at the end of a line (or of the
+      text), ignoring trailing blanks. */
+  bool at_eol() 
+    { 
+    skip_blanks(); 
+    return p >= end || *p == '\n'; 
+    }
+
+  /** Move to the start of the next line. Returns false if there is no
+      next line. */
+  bool next_line()
+    {
+    const char *nl = (const char *)memchr (p, '\n', end - p);
+    if (!nl) 
+      {
+      p = end;
+      return false;
+      }
+    p = nl + 1;
+    return p < end;
+    }
+
+  /** Read the next token on the current line. A token ends at a 
+      blank, the end of the line, or a colon; a colon that ends a 
+      token is skipped. Returns false if there are no more tokens on
+      this line. */
+  bool token (const char *&start, size_t &len)
+    {
+    skip_blanks();
+    start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != ':') 
+      p++;
+    len = p - start;
+    if (p < end && *p == ':') p++;
+    return len > 0;
+    }
+
+  /** Read the next token, and return true if it is the given word. */
+  bool expect (const char *word)
+    {
+    const char *s;
+    size_t len;
+    if (!token (s, len)) return false;
+    return len == strlen (word) && memcmp (s, word, len) == 0;
+    }
+
+  /** Read the next token as an unsigned decimal number. */
+  bool u64 (uint64_t &v)
+    {
+    skip_blanks();
+    if (p >= end || *p < '0' || *p > '9') return false;
+    v = 0;
+    while (p < end && *p >= '0' && *p <= '9') 
+      v = v * 10 + (*p++ - '0');
+    return true;
+    }
+
+  /** Read the next token as a decimal number, with an optional 
+      fractional part. */
+  bool dbl (double &v)
+    {
+    uint64_t i;
+    if (!u64 (i)) return false;
+    v = (double)i;
+    if (p < end && *p == '.')
+      {
+      p++;
+      double scale = 0.1;
+      while (p < end && *p >= '0' && *p <= '9') 
+        {
+        v += (*p++ - '0') * scale;
+        scale /= 10;
+        }
+      }
+    return true;
+    }
+  };
+
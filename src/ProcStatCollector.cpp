@@ -0,0 +1,121 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ProcStatCollector.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <stdio.h>
+
+#include "ProcStatCollector.h"
+
+ProcStatCollector::ProcStatCollector() : 
+        file ("/proc/stat", 65536), cpus (1), 
+        context_switches ("cpu.context_switches", "/s"), 
+        running ("procs.running", ""), blocked ("procs.blocked", ""), 
+        ctxt (0), last_time (0)
+  {
+  cpus[0].busy = Metric ("cpu.busy", "%");
+  cpus[0].user_time = Metric ("cpu.user", "%");
+  cpus[0].system_time = Metric ("cpu.system", "%");
+  cpus[0].iowait_time = Metric ("cpu.iowait", "%");
+  cpus[0].idle_time = Metric ("cpu.idle", "%");
+  }
+
+void ProcStatCollector::cpu_line (ProcParser& p, size_t index, 
+      MetricSink& sink)
+  {
+  if (index >= cpus.size())
+    {
+    // A CPU we haven't seen before. This only happens the first time,
+    //   or if a CPU comes online.
+    size_t first = cpus.size();
+    cpus.resize (index + 1);
+    for (size_t i = first; i < cpus.size(); i++)
+      {
+      char s[32];
+      snprintf (s, sizeof (s), "cpu.%d.busy", (int)i - 1);
+      cpus[i].busy = Metric (s, "%");
+      snprintf (s, sizeof (s), "%d", (int)i - 1);
+      cpus[i].busy.label ("cpu", s);
+      }
+    }
+
+  // The fields are: user nice system idle iowait irq softirq steal.
+  //   There may be more, but guest time is already counted in user.
+  uint64_t f[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 8 && p.u64 (f[i]); i++) {}
+  uint64_t total = 0;
+  for (int i = 0; i < 8; i++) total += f[i];
+  uint64_t idle = f[3] + f[4];
+  uint64_t user = f[0] + f[1];
+  uint64_t system = f[2] + f[5] + f[6];
+  uint64_t iowait = f[4];
+
+  Cpu& c = cpus[index];
+  if (c.primed && total > c.total)
+    {
+    double dt = (double)(total - c.total);
+    sink.metric (c.busy.set (100.0 * (dt - delta (idle, c.idle)) / dt));
+    if (index == 0)
+      {
+      sink.metric (c.user_time.set (100.0 * delta (user, c.user) / dt));
+      sink.metric (c.system_time.set 
+        (100.0 * delta (system, c.system) / dt));
+      sink.metric (c.iowait_time.set 
+        (100.0 * delta (iowait, c.iowait) / dt));
+      sink.metric (c.idle_time.set (100.0 * delta (idle, c.idle) / dt));
+      }
+    }
+  c.total = total;
+  c.idle = idle;
+  c.user = user;
+  c.system = system;
+  c.iowait = iowait;
+  c.primed = true;
+  }
+
+void ProcStatCollector::collect (MetricSink& sink)
+  {
+  if (!file.read()) return;
+  double now = monotonic_seconds();
+  ProcParser p (file);
+  do
+    {
+    const char *s;
+    size_t len;
+    if (!p.token (s, len)) continue;
+    if (len >= 3 && memcmp (s, "cpu", 3) == 0)
+      {
+      size_t index = 0;
+      for (size_t i = 3; i < len; i++)
+        index = index * 10 + (s[i] - '0');
+      if (len > 3) index++;
+      cpu_line (p, index, sink);
+      }
+    else if (len == 4 && memcmp (s, "ctxt", 4) == 0)
+      {
+      uint64_t v;
+      if (!p.u64 (v)) continue;
+      if (last_time > 0 && now > last_time)
+        sink.metric (context_switches.set 
+          (delta (v, ctxt) / (now - last_time)));
+      ctxt = v;
+      }
+    else if (len == 13 && memcmp (s, "procs_running", 13) == 0)
+      {
+      uint64_t v;
+      if (p.u64 (v)) sink.metric (running.set ((double)v));
+      }
+    else if (len == 13 && memcmp (s, "procs_blocked", 13) == 0)
+      {
+      uint64_t v;
+      if (p.u64 (v)) sink.metric (blocked.set ((double)v));
+      }
+    } while (p.next_line());
+  last_time = now;
+  }
+
@@ -0,0 +1,58 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ProcStatCollector.h
+
+  Collects CPU utilization from /proc/stat. For all CPUs together, 
+  the metrics are cpu.busy, cpu.user, cpu.system, cpu.iowait and 
+  cpu.idle, as percentages of the time since the last sample. For 
+  each CPU there is cpu.N.busy. There are also cpu.context_switches
+  (per second), procs.running and procs.blocked.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <vector>
+
+#include "Collector.h"
+#include "ProcFile.h"
+
+class ProcStatCollector : public Collector
+  {
+  private:
+
+  /** The state of one CPU line in /proc/stat. CPU 0 in the list of
+      these is the aggregate "cpu" line, and the others are "cpu0", 
+      "cpu1", etc. */
+  class Cpu
+    {
+    public:
+    Metric busy, user_time, system_time, iowait_time, idle_time;
+    uint64_t total, idle, user, system, iowait;
+    bool primed;
+    Cpu() : total (0), idle (0), user (0), system (0), iowait (0), 
+      primed (false) {}
+    };
+
+  ProcFile file;
+  std::vector<Cpu> cpus;
+  Metric context_switches, running, blocked;
+  uint64_t ctxt;
+  double last_time;
+
+  /** Parse the rest of a cpu line, and report metrics for it. */
+  void cpu_line (ProcParser& p, size_t index, MetricSink& sink);
+
+  public:
+
+  ProcStatCollector();
+
+  const char *get_name() const override { return "stat"; }
+
+  void collect (MetricSink& sink) override;
+  };
+
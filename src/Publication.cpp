@@ -0,0 +1,46 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Publication.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <proton/codec/map.hpp>
+#include <proton/message.hpp>
+#include <proton/scalar.hpp>
+#include <proton/value.hpp>
+
+#include "Publication.h"
+#include "config.h"
+
+void Publication::set_message (const proton::message& m)
+  {
+  m.encode (encoded);
+  set_fields (m);
+  }
+
+void Publication::set_fields (const proton::message& m)
+  {
+  to = m.to();
+  proton::get (m.properties().value(), properties);
+  PropertyMap::const_iterator k = properties.find (CONFLATION_KEY);
+  key = k == properties.end() ? to : proton::to_string (k->second);
+  PropertyMap::const_iterator v = properties.find ("value");
+  has_value = false;
+  if (v != properties.end())
+    {
+    try
+      {
+      value = proton::coerce<double> (v->second);
+      has_value = true;
+      }
+    catch (const proton::conversion_error& e)
+      {
+      }
+    }
+  if (m.body().type() == proton::STRING)
+    text = proton::get<std::string> (m.body());
+  }
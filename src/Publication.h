@@ -0,0 +1,115 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Publication.h
+
+  A Publication is a message that has been published to a Queue. It
+  is built once, by the QueueManager, and then shared (not copied) by
+  every subscriber that the message is delivered to, and by any 
+  Sender that has to buffer it. A Publication is never modified after
+  it has been published, so it can be read from any thread without
+  locking.
+
+  A Publication does not hold a proton::message, because a 
+  proton::message is not safe to share, even if nobody means to 
+  change it: encoding it, or reading its properties, updates its
+  internal state. So the message is encoded once, while only the
+  publisher has it, and each connection decodes its own copy to send.
+  The fields that the Queues need -- for selectors, spools, and 
+  shared memory -- are copied out of the message at the same time, 
+  into plain types that can be read by any number of threads.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <proton/message.hpp>
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Flow;
+
+/** A Flow is shared by the Receiver that a client publishes on, and
+    the messages the client has published. See Receiver.h. */
+typedef std::shared_ptr<Flow> FlowPtr;
+
+/** The application properties of a Publication. */
+typedef std::map<std::string, proton::scalar> PropertyMap;
+
+class Publication
+  {
+  public:
+
+  /** The AMQP message, encoded, exactly as it will be sent to 
+      clients. */
+  std::vector<char> encoded;
+
+  /** The name of the queue the message was published to, which is
+      also the message's "to" address. */
+  std::string to;
+
+  /** The message's application properties. */
+  PropertyMap properties;
+
+  /** The message body, if it is a string. A Metric has the text form 
+      of its value. */
+  std::string text;
+
+  /** Set if the message has a numeric "value" property. */
+  bool has_value;
+
+  /** The "value" property, if has_value is set. */
+  double value;
+
+  /** The sequence number of the message. Every message published has
+      a higher number than the last, and it is also the message ID,
+      so a client that reconnects can ask to resume from where it
+      left off. */
+  uint64_t seq;
+
+  /** The conflation key. On a queue that conflates, a subscriber that
+      is short of credit holds only the latest message with each key.
+      This is the value of the message's conflation key property 
+      (see config.h) if it has one, or the name of the queue it was 
+      published to. */
+  std::string key;
+
+  /** When the message was published, in nanoseconds on the monotonic
+      clock. This is used to measure latency. */
+  uint64_t published;
+
+  /** Set if the message was published by a client, on a Receiver 
+      link. Each Queue the message goes to tells the Flow when it has
+      fanned the message out. */
+  FlowPtr flow;
+
+  Publication() : has_value (false), value (0), seq (0), published (0)
+    {
+    }
+
+  /** Encode the message, and copy the fields above from it. The 
+      message's ID, "to" address, body and properties must already be
+      set. This must be done before the Publication is shared. */
+  void set_message (const proton::message& m);
+
+  /** Copy the fields above, apart from the encoded message, from a 
+      message that has just been decoded from it. */
+  void set_fields (const proton::message& m);
+  };
+
+/** Publications are reference-counted, and immutable. The last Sender
+    to finish with a Publication will free it. */
+typedef std::shared_ptr<const Publication> PublicationPtr;
+
+/** A list of Publications, for delivering several at once. */
+typedef std::vector<PublicationPtr> PublicationList;
+typedef std::shared_ptr<const PublicationList> PublicationListPtr;
+
@@ -21,47 +21,281 @@
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
 
+#include <algorithm>
 #include <iostream>
 
+#include "Aggregator.h"
 #include "Queue.h"
+#include "Receiver.h"
 #include "logging.h"
 
-Queue::Queue (proton::container& c, const std::string& n) :
-        work_queue(c), name(n)
+Queue::Queue (proton::container& c, const std::string& n, 
+        const QueuePolicy& p, Spool* sp, ShmRing* r) :
+        work_queue(c), name(n), policy(p), dropped(0), spool(sp), ring(r),
+        aggregator(0), users(0), idle_since(Stats::now()), last_published(0),
+        retired(false)
   {
+  history.reset (std::max (policy.last_values, policy.replay_size));
   }
 
-void Queue::queueMsg (proton::message m) 
+Queue::~Queue()
+  {
+  delete spool;
+  delete ring;
+  delete aggregator;
+  }
+
+bool Queue::add_user()
+  {
+  // The QueueManager sets retired before it checks users, and we 
+  //   add to users before we check retired, so one of us sees the
+  //   other.
+  users++;
+  if (!retired) return true;
+  users--;
+  return false;
+  }
+
+void Queue::remove_user()
+  {
+  if (--users == 0) idle_since = Stats::now();
+  }
+
+bool Queue::retire (uint64_t now, uint64_t grace, uint64_t keep)
+  {
+  // A new Queue would open the same spool or ring as this one, while
+  //   this one might still be writing to it
+  if (spool || ring) return false;
+  if (users > 0 || now < idle_since + grace) return false;
+  if (last_published && now < last_published + keep) return false;
+  retired = true;
+  if (users == 0) return true;
+  retired = false;
+  return false;
+  }
+
+uint64_t Queue::last_used() const
+  {
+  if (spool || ring || users > 0) return 0;
+  return std::max<uint64_t> (idle_since, last_published);
+  }
+
+void Queue::queueMsg (PublicationPtr p) 
   { 
-  DDBG (std::cout << "Adding message to queue " << name << std::endl;)
+  DDBG (log << "Adding message to queue " << name;)
+  Stats::count (Stats::QUEUE_WORK_DONE);
+  Stats::record (Stats::QUEUE_LATENCY, Stats::now() - p->published);
+  if (history.capacity() > 0) 
+    {
+    history.push_back (p);
+    last_published = p->published;
+    }
+  if (spool) spool->append (*p);
+  if (ring) ring->write (*p);
   int added = 0;
-  for (Subscriptions::iterator i = subscriptions.begin(); 
-        i != subscriptions.end(); i++)
+  for (Batches::iterator i = batches.begin(); i != batches.end(); i++)
     {
-    // Put a sendMsg() call into the Sender's work queue.
-    // (*i).first is the Sender instance. Note that it is passed
-    //   to make_work in the argument list, as it is the implicit
-    //   'this' in the method call sendMsg() 
-    (*i).first->add_work (make_work (&Sender::sendMsg, (*i).first, m));
-    added++;
+    // Put a sendBatch() call into the connection's work queue.
+    //   (*i).first is the work queue, and (*i).second the list
+    //   of Senders that share it.
+    SenderBatchPtr b = (*i).second.senders;
+    if ((*i).second.selectors > 0)
+      {
+      // Some of the Senders on this connection have selectors -- 
+      //   make a batch of just the ones that want this message.
+      SenderBatch* matched = new SenderBatch();
+      for (SenderBatch::const_iterator s = b->begin(); s != b->end(); s++)
+        {
+        const Selector* sel = s->sender->get_selector();
+        if (!sel || sel->matches (p->properties)) matched->push_back (*s);
+        }
+      b = SenderBatchPtr (matched);
+      if (b->empty()) continue;
+      }
+    (*i).first->add (proton::make_work (&Sender::sendBatch, b, p));
+    Stats::count (Stats::FANOUT_ITEMS);
+    Stats::count (Stats::SENDER_WORK_ADDED);
+    added += b->size();
     }
-  DDBG(std::cout << "Added message for " << added 
-    << " subscriber(s)" << std::endl;)
+  DDBG(log << "Added message for " << added 
+    << " subscriber(s) on " << batches.size() << " connection(s)";)
+  // If a client published the message, it can have more credit now
+  if (p->flow) p->flow->drained();
   }
 
 void Queue::subscribe (Sender* s) 
   {
-  DINFO (std::cout << "Client subscribed to queue " << name << std::endl;)
+  DINFO (log << "Client subscribed to queue " << name;)
+  Stats::count (Stats::QUEUE_WORK_DONE);
   subscriptions[s] = 0;
+  uint64_t from;
+  bool replay = s->get_replay_from (from);
+  if (replay && spool)
+    {
+    // The subscriber joins the batch when it has caught up
+    if (from < spool->first())
+      DINFO (log << "Replay on " << name << " from " << from 
+         << " starts at " << spool->first() 
+         << " -- earlier messages are lost";)
+    send_spooled (SenderRef (s), spool->find (from));
+    return;
+    }
+  add_to_batch (s);
+
+  // Send the recent messages, or the ones the subscriber asked to 
+  //   replay. Anything published after this will be scheduled on the
+  //   same work queue later, so the subscriber gets everything in 
+  //   order.
+  if (history.empty()) return;
+  size_t first;
+  if (replay)
+    {
+    // Publishers on different threads might have added messages in a
+    //   slightly different order from their sequence numbers, so 
+    //   look at them all.
+    first = 0;
+    if (history.front()->seq > from)
+      DINFO (log << "Replay on " << name << " from " << from 
+         << " starts at " << history.front()->seq 
+         << " -- earlier messages are lost";)
+    }
+  else
+    {
+    from = 0;
+    first = history.size() - std::min (history.size(), policy.last_values);
+    }
+  PublicationList* recent = new PublicationList();
+  const Selector* sel = s->get_selector();
+  for (size_t i = first; i < history.size(); i++)
+    {
+    const PublicationPtr& h = history[i];
+    if (h->seq >= from && (!sel || sel->matches (h->properties))) 
+      recent->push_back (h);
+    }
+  if (recent->empty())
+    {
+    delete recent;
+    return;
+    }
+  DDBG (log << "Sending " << recent->size() 
+     << " recent message(s) to new subscriber on " << name;)
+  s->add_work (make_work (&Sender::sendList, s, s->get_generation(), 
+    PublicationListPtr (recent)));
+  }
+
+void Queue::catch_up (SenderRef r, uint64_t position)
+  {
+  Stats::count (Stats::QUEUE_WORK_DONE);
+  Sender* s = r.sender;
+  if (s->get_generation() != r.generation 
+        || subscriptions.find (s) == subscriptions.end()) return;
+  send_spooled (r, position);
+  }
+
+void Queue::send_spooled (SenderRef r, uint64_t position)
+  {
+  Sender* s = r.sender;
+  // Messages are spooled as they arrive, not quite in order, so every
+  //   read picks out the ones at or after the first the client asked
+  //   for
+  uint64_t from;
+  s->get_replay_from (from);
+
+  // Read no more than half a buffer at a time, so that a subscriber 
+  //   that is short of credit doesn't overflow. It asks for more when 
+  //   its buffer is half empty.
+  size_t max = std::max (policy.buffer_size / 2, (size_t)1);
+  const Selector* sel = s->get_selector();
+  PublicationList* list = new PublicationList();
+  uint64_t next = position;
+  bool done;
+  do
+    {
+    PublicationList read;
+    done = spool->read (next, from, max, read, next);
+    for (size_t i = 0; i < read.size(); i++)
+      if (!sel || sel->matches (read[i]->properties)) 
+        list->push_back (read[i]);
+    } while (list->empty() && !done);
+
+  DDBG (log << "Sending " << list->size() 
+     << " spooled message(s) to subscriber on " << name;)
+  PublicationListPtr l (list);
+  if (done)
+    {
+    // Nothing can be published between reading the end of the spool 
+    //   and joining the batch, because both happen on this work queue.
+    add_to_batch (s);
+    if (!l->empty())
+      s->add_work (make_work (&Sender::sendList, s, r.generation, l));
+    }
+  else
+    s->add_work (make_work (&Sender::sendSpooled, s, r.generation, l, 
+      next));
   }
 
 void Queue::unsubscribe (Sender* s) 
   {
-  DINFO (std::cout << "Client unsubscribed from queue " << name << std::endl;)
-  subscriptions.erase(s);
+  DINFO (log << "Client unsubscribed from queue " << name;)
+  Stats::count (Stats::QUEUE_WORK_DONE);
+  remove (s);
   // Tell the Sender it has been unsubscribed -- schedule a call to
-  //   Sender::unsubscribed
-  s->add_work (make_work (&Sender::unsubscribed, s));
+  //   Sender::unsubscribed. This runs after any messages already 
+  //   scheduled for the Sender, so they can't find it released. If 
+  //   the connection closed in the meantime, nothing else will run
+  //   for the Sender, so release it here.
+  if (!s->add_work (make_work (&Sender::unsubscribed, s))) 
+    {
+    s->release();
+    remove_user();
+    }
+  }
+
+void Queue::detach (Sender* s) 
+  {
+  DINFO (log << "Client disconnected from queue " << name;)
+  Stats::count (Stats::QUEUE_WORK_DONE);
+  remove (s);
+  // The connection has gone, and the Sender has already dropped its
+  //   link, so all that's left is to return it to the pool. Nothing 
+  //   else will run on the connection's work queue.
+  s->release();
+  remove_user();
+  }
+
+void Queue::add_to_batch (Sender* s) 
+  {
+  // The batch might be in use by a work item that has not run yet,
+  //   so make a new one, rather than modifying it.
+  proton::work_queue* wq = &s->get_work_queue();
+  ConnectionBatch& cb = batches[wq];
+  SenderBatch* b = cb.senders ? new SenderBatch (*cb.senders) 
+                              : new SenderBatch();
+  b->push_back (SenderRef (s));
+  cb.senders = SenderBatchPtr (b);
+  if (s->get_selector()) cb.selectors++;
+  }
+
+void Queue::remove (Sender* s) 
+  {
+  subscriptions.erase(s);
+  Batches::iterator i = batches.find (&s->get_work_queue());
+  if (i != batches.end())
+    {
+    SenderBatch* b = new SenderBatch (*(i->second.senders));
+    b->erase (std::remove (b->begin(), b->end(), s), b->end());
+    bool removed = b->size() < i->second.senders->size();
+    if (b->empty())
+      {
+      delete b;
+      batches.erase (i);
+      }
+    else
+      {
+      i->second.senders = SenderBatchPtr (b);
+      if (removed && s->get_selector()) i->second.selectors--;
+      }
+    }
   }
 
 
@@ -22,7 +22,17 @@
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
 
+#include <atomic>
+
+#include "Publication.h"
+#include "QueuePolicy.h"
+#include "RingBuffer.h"
 #include "Sender.h"
+#include "ShmRing.h"
+#include "Spool.h"
+#include "Stats.h"
+
+class Aggregator;
 
 /** Subscriptions is a type that defines a 
     list of subscriptions, that is,
@@ -30,21 +40,38 @@
     it's a map, because Senders are unique within a particular
     queue. Moreover, it's a map from a Sender to an int.
     I had in mind to use the int to store the amount of 
-    link credit associated with the Sender, but I decided
-    not to handle credit in this simple application at
-    all (for now, at least). Note also that the map
+    link credit associated with the Sender but, in the end,
+    credit is handled by the Sender itself, because Proton
+    reports credit on the Sender's thread. Note also that the map
     is based on Sender* objects. The Queue does not
     own these objects -- they are instantiated by the
     ConnectionManager instance that belongs to a specific
     client connection. */
 typedef std::map<Sender*, int> Subscriptions;
 
+/** A ConnectionBatch is the batch of subscribers on one connection,
+    and a count of how many of them have message selectors. If none
+    has, every message goes to the whole batch, without looking at
+    the individual subscribers. */
+class ConnectionBatch
+  {
+  public:
+  SenderBatchPtr senders;
+  int selectors;
+  ConnectionBatch() : selectors (0) {}
+  };
+
+/** Batches maps a connection's work queue to the batch of subscribers
+    that are on that connection. */
+typedef std::map<proton::work_queue*, ConnectionBatch> Batches;
+
 /** Queue represents a queue, that is, a name that clients
     create links to, to receive messages. In this simple
     application, a Queue is really nothing more than a 
     link between a name, and a set of Sender objects that
     represent the subscribers to the queue. No storage is
-    associated with a Queue. */
+    associated with a Queue, unless its policy asks for a 
+    Spool, or a ShmRing. */
 class Queue
   {
   private:
@@ -59,32 +86,166 @@ class Queue
      queue. */
   Subscriptions subscriptions;
 
+  /** The same subscribers as above, but grouped by connection, so
+      that a message can be delivered to all the subscribers on a 
+      connection by a single work item. */
+  Batches batches;
+
+  /** The delivery policy for this queue. This is fixed when the
+      Queue is created, so Senders can read it from their own
+      threads. */
+  const QueuePolicy policy;
+
+  /** Count of messages discarded by subscribers to this queue, 
+      because the subscribers were not keeping up. The count is
+      updated by the Senders, on their own threads. */
+  std::atomic<unsigned long> dropped;
+
+  /** The most recent messages published to this queue -- as many as
+      the larger of the policy's last_values and replay_size. The last
+      few are delivered to each new subscriber, so it does not have to
+      wait for the next message to learn the current state. A client 
+      that asks to resume from a sequence number -- the first one it
+      has not seen -- gets all those from that number on. The history
+      is kept whether or not anybody is subscribed. */
+  RingBuffer<PublicationPtr> history;
+
+  /** If the policy asks for one, the spool that keeps every message
+      published to this queue on disk, or null. This Queue owns it. */
+  Spool* spool;
+
+  /** If the policy asks for one, the ring in shared memory that every
+      message published to this queue is written to, or null. This 
+      Queue owns it. */
+  ShmRing* ring;
+
+  /** The Aggregator that feeds this queue, if it is a derived queue,
+      or null. This Queue owns it. */
+  Aggregator* aggregator;
+
+  /** The number of subscribers and producers using this queue: each
+      Sender bound to it, and each Receiver publishing to it by name.
+      A queue with no users for long enough can be reclaimed. */
+  std::atomic<int> users;
+
+  /** When the number of users last fell to zero, in nanoseconds on
+      the monotonic clock. */
+  std::atomic<uint64_t> idle_since;
+
+  /** When a message was last added to the history, in nanoseconds on
+      the monotonic clock, or zero if none has been. A queue that keeps
+      messages for new subscribers is kept for longer than one that
+      doesn't. */
+  std::atomic<uint64_t> last_published;
+
+  /** Set when the QueueManager is removing this queue. No more users
+      can be added. */
+  std::atomic<bool> retired;
+
+  /** Add a Sender to the batch for its connection, so it gets each
+      new message. */
+  void add_to_batch (Sender* s);
+
+  /** Send a subscriber the next few messages from the spool, from
+      the given position in it, or, if there are no more, add it to 
+      the batch. See catch_up(). */
+  void send_spooled (SenderRef r, uint64_t position);
+
+  /** Remove a Sender from the subscriptions and the batches. */
+  void remove (Sender* s);
+
   public:
 
   /** Note that the Queue class needs a reference to the container, because
       the container manages the work queue. */
-  Queue (proton::container &c, const std::string& n);
+  Queue (proton::container &c, const std::string& n, const QueuePolicy& p,
+      Spool* sp = 0, ShmRing* r = 0);
+
+  ~Queue();
+
+  /** Give this queue the Aggregator that feeds it. */
+  void set_aggregator (Aggregator* a) { aggregator = a; }
+
+  /** Add a user. Returns false if the queue is being removed, in 
+      which case the caller must create a new one. This method is 
+      thread-safe. */
+  bool add_user();
+
+  /** Remove a user, when a Sender is released, or a Receiver is
+      deleted. This method is thread-safe. */
+  void remove_user();
+
+  /** Mark this queue as being removed, if it has had no users for 
+      at least grace nanoseconds, and nothing has been published to it
+      for at least keep nanoseconds. Returns false, and changes 
+      nothing, if it has, or if it has a spool or a ring, which are 
+      never reclaimed. This is only called by the QueueManager, while
+      it holds the lock that add_user() falls back on. */
+  bool retire (uint64_t now, uint64_t grace, uint64_t keep);
+
+  /** Get the time this queue was last used -- when its last user 
+      went, or a message was last published to it, whichever is 
+      later -- or zero if it has users now, or can never be 
+      reclaimed. */
+  uint64_t last_used() const;
+
+  /** Get the delivery policy for this queue. */
+  const QueuePolicy& get_policy() const { return policy; }
+
+  /** Called by a Sender when it discards messages. */
+  void add_dropped (unsigned long n) { dropped += n; }
+
+  /** Get the number of messages discarded by subscribers to this
+      queue, since the queue was created. */
+  unsigned long get_dropped() const { return dropped; }
 
   /** Add a function call to my work queue. */
   bool add_work (proton::work f) 
     {
+    Stats::count (Stats::QUEUE_WORK_ADDED);
     return work_queue.add(f);
     }
 
-  /** Add a message to this queue. Since there is no storage 
-      associaeted with queues in this simple application, and we
-      aren't handling credit, all we do is send the message 
-      directly to every subscriber associated with the Queue. */
-  void queueMsg (proton::message m);
+  /** Add a message to this queue, on the Queue's own thread. The 
+      message goes into the history of last values and replay, if the
+      queue keeps one, and is written to the queue's spool and 
+      shared memory ring, if it has them. It is then passed to every
+      subscriber: we schedule one work item per client connection, 
+      not one per subscriber, and all the subscribers share the same
+      Publication. Subscribers whose selectors don't match the message
+      are left out of the batch, so the message is never sent to 
+      them. Finally, if a client published the message, its Receiver
+      is told, so it can give the client more credit. */
+  void queueMsg (PublicationPtr p);
 
   /** Register a Sender as being a subscriber to this queue. This 
       process is triggered by the ConnectionHandler's on_sender_open
       method being called in response to the client opening a
-      new link. */ 
+      new link. The most recent messages, or those the subscriber
+      asked to replay, are sent to the new subscriber at once, ahead
+      of any new ones. If the queue has a spool, a subscriber that
+      asked to replay is sent the messages from the spool instead,
+      a few at a time -- see catch_up(). */ 
   void subscribe (Sender* s);
 
+  /** Send a subscriber that asked to resume the next few messages 
+      from the spool, from the given position in it. The Sender asks
+      for more, by calling this again, when it has room for them. Once it
+      has caught up, it joins the other subscribers, and gets new 
+      messages as they are published. Nothing is sent if the Sender
+      has been released, or unsubscribed, since the SenderRef was 
+      made. */
+  void catch_up (SenderRef r, uint64_t position);
+
   /** Remove the sender as a subscriber to this Queue. This process
-      is triggered by closing the session or the transport. */
+      is triggered by closing the link or the session. The Sender 
+      releases itself, on its own work queue. */
   void unsubscribe (Sender* s); 
+
+  /** Remove the sender as a subscriber to this Queue, because its
+      connection has closed, and return it to the pool. The 
+      ConnectionHandler has already disconnected it, on the 
+      connection's thread. */
+  void detach (Sender* s); 
   };
 
@@ -20,6 +20,12 @@
 #include <proton/source_options.hpp>
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
+#include <proton/codec/encoder.hpp>
+#include <proton/symbol.hpp>
+#include <proton/timestamp.hpp>
+
+#include <stdio.h>
+#include <time.h>
 
 #include <iostream>
 #include <ostream>
@@ -27,41 +33,216 @@
 
 #include "Queue.h"
 #include "QueueManager.h"
+#include "Receiver.h"
+#include "Stats.h"
+#include "config.h"
 #include "logging.h"
 
 
 QueueManager::QueueManager (proton::container& c) :
-        container(c), work_queue(c), message_count(1)
+        container(c), work_queue(c), sequence(1), 
+        max_queues (DEFAULT_MAX_QUEUES), spool_dir (DEFAULT_SPOOL_DIR), 
+        shm_dir (SHM_DIR), shards (1, this)
+  {
+  }
+
+void QueueManager::start()
   {
+  Stats::count (Stats::MANAGER_WORK_ADDED);
+  work_queue.schedule (proton::duration (QUEUE_RECLAIM_INTERVAL), 
+    proton::make_work (&QueueManager::reclaim, this));
   }
 
 void QueueManager::publish (const std::string &name, const std::string &text)
   {
-  DDBG (std::cout << "Publishing to queue " << name << std::endl;)
-  // See if the queue exists -- there is no storage in this utility so,
-  //  if there is no queue, no point trying to publish a message.
-  QueueList::iterator i = queues.find (name);
-  if (i != queues.end())
+  Stats::count (Stats::PUBLISHED);
+  publish_text (name, text, 0);
+  }
+
+void QueueManager::publish (const std::string &name, const std::string &text,
+       const proton::message::property_map &properties)
+  {
+  Stats::count (Stats::PUBLISHED);
+  publish_text (name, text, &properties);
+  }
+
+void QueueManager::publish (const std::string &name, const std::string &text,
+       const proton::message::property_map &properties, const FlowPtr &flow)
+  {
+  Stats::count (Stats::PUBLISHED);
+  publish_text (name, text, &properties, flow);
+  }
+
+void QueueManager::publish (const Metric &m)
+  {
+  Stats::count (Stats::PUBLISHED);
+  publish_metric (m);
+  }
+
+std::vector<Queue*>& QueueManager::find_targets (const QueueIndex& index,
+       const std::string &name)
+  {
+  // The queue with this name exists, unless there were too many to
+  //   create it, so a message only goes nowhere if it can't be kept
+  //   for later subscribers either. The list of targets is reused, 
+  //   to save allocating one for every message.
+  static thread_local std::vector<Queue*> targets;
+  targets.clear();
+  index.match (name, targets);
+  if (targets.empty())
+    DDBG (log << "Queue " << name << 
+       " has no queue -- message lost";)
+  return targets;
+  }
+
+/*=====================================================================
+
+  scratch_message
+
+  Get an empty message to build a Publication in. It is only used 
+  until the Publication has been encoded, so each thread reuses one.
+
+=====================================================================*/
+static proton::message& scratch_message()
+  {
+  static thread_local proton::message m;
+  m.clear();
+  return m;
+  }
+
+PublicationPtr QueueManager::seal (const std::string &name, 
+       Publication* pub, proton::message& msg, uint64_t start, 
+       const FlowPtr &flow)
+  {
+  // Fill in the rest of the message, including a message ID which is
+  //   the sequence number (which increments atomically, making this 
+  //   method thread-safe.) The first Shard numbers the messages for 
+  //   all of them, so a message has the same ID on every Shard.
+  pub->seq = shards[0]->sequence++;
+  // Subscribers to wildcard queues need to know where the message
+  //   was actually published
+  msg.to (name);
+  msg.id (proton::message_id (pub->seq));
+  pub->set_message (msg);
+  pub->published = start;
+  pub->flow = flow;
+  return PublicationPtr (pub);
+  }
+
+void QueueManager::deliver (const PublicationPtr &p)
+  {
+  // Find the queue with this name, creating it if need be, so that it
+  //   keeps the message for clients that subscribe later, and any 
+  //   wildcard queues that match it. Holding the snapshot stops the 
+  //   Queues being disposed of until we have handed them the message.
+  QueueSnapshot index = snapshot_for (p->to);
+  const std::vector<Queue*>& targets = find_targets (*index, p->to);
+  if (p->flow) p->flow->handed (targets.size());
+  // The Queue's subscriptions can only be read on its own 
+  //   work queue -- we could be on any thread here.
+  for (size_t i = 0; i < targets.size(); i++)
+    targets[i]->add_work (proton::make_work (&Queue::queueMsg, 
+       targets[i], p)); 
+
+  // This comes last, because publishing the results re-enters this
+  //   method, and reuses the list of targets.
+  if (p->has_value && !index->aggregators.empty())
+    aggregate (*index, p->to, p->value);
+  }
+
+void QueueManager::publish_text (const std::string &name, 
+       const std::string &text, 
+       const proton::message::property_map *properties, 
+       const FlowPtr &flow)
+  {
+  DDBG (log << "Publishing to queue " << name;)
+  uint64_t start = Stats::now();
+  proton::message& msg = scratch_message();
+  msg.body (text);
+  if (properties) msg.properties() = *properties;
+  // The message is encoded once, and every Shard shares the 
+  //   Publication
+  PublicationPtr p = seal (name, new Publication(), msg, start, flow);
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->deliver (p);
+  Stats::record (Stats::PUBLISH_TIME, Stats::now() - start);
+  }
+
+void QueueManager::publish_metric (const Metric &m)
+  {
+  DDBG (log << "Publishing metric to queue " << m.name;)
+  uint64_t start = Stats::now();
+  proton::message& msg = scratch_message();
+  // The body is encoded straight into the message, without building
+  //   a proton::list or proton::map to copy into it. See Metric.h
+  //   for the layout.
+  proton::codec::encoder e (msg.body());
+  e << proton::codec::start::list() << m.name << m.value 
+    << m.unit_symbol << m.monotonic 
+    << proton::timestamp (m.wall) << proton::codec::start::map();
+  for (size_t i = 0; i < m.labels.size(); i++)
+    e << m.labels[i].first << m.labels[i].second;
+  e << proton::codec::finish() << proton::codec::finish();
+  // The value and labels are also properties, for selectors. The 
+  //   Metric keeps its labels as properties already.
+  proton::message::property_map& props = msg.properties();
+  props = m.properties;
+  props.put ("value", m.value);
+  Publication* pub = new Publication();
+  char s[32];
+  snprintf (s, sizeof (s), "%g", m.value);
+  pub->text = s;
+  PublicationPtr p = seal (m.name, pub, msg, start, FlowPtr());
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->deliver (p);
+  Stats::record (Stats::PUBLISH_TIME, Stats::now() - start);
+  }
+
+void QueueManager::aggregate (const QueueIndex& index, 
+       const std::string &name, double value)
+  {
+  AggregatorList::const_iterator i = index.aggregators.find (name);
+  if (i == index.aggregators.end()) return;
+
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  double now = ts.tv_sec + ts.tv_nsec / 1e9;
+
+  const std::vector<Aggregator*>& list = i->second;
+  for (size_t j = 0; j < list.size(); j++)
     {
-    // Format the message, including a message ID based on the
-    //   message count (which increments atomically, making this 
-    //   method thread-safe. Not that it really needs to be.)
-    proton::message msg (text);
-    char s[20];
-    // Just a litte gotcha -- the number of digits required to format
-    //  an "int" could be platform dependent. I'm not worrying about
-    //  it in this simple example. 
-    snprintf (s, sizeof (s) - 1, "ID:%08X", (int)(message_count++));
-    proton::message_id id (s); 
-    msg.id (id);
-    (*i).second->queueMsg (msg); 
+    double result;
+    unsigned long samples;
+    if (!list[j]->add (now, value, result, samples)) continue;
+    char s[32];
+    snprintf (s, sizeof (s), "%g", result);
+    proton::message::property_map props;
+    props.put ("value", result);
+    props.put ("samples", (uint64_t)samples);
+    props.put ("period", list[j]->get_period());
+    Stats::count (Stats::PUBLISHED);
+    // Each Shard has its own Aggregators, for its own derived queues,
+    //   so the result only goes to this one
+    proton::message& msg = scratch_message();
+    msg.body (std::string (s));
+    msg.properties() = props;
+    deliver (seal (list[j]->get_derived(), new Publication(), msg, 
+      Stats::now(), FlowPtr()));
     }
-  else
-    DDBG (std::cout << "Queue " << name << 
-       " has not been subscribed -- message lost" << std::endl;)
   }
 
-void QueueManager::find_queue_for_sender (Sender* s, std::string qn) 
+bool QueueManager::reserved (const std::string& name)
+  {
+  return name.compare (0, sizeof (SYS_QUEUE_PREFIX) - 1, 
+    SYS_QUEUE_PREFIX) == 0;
+  }
+
+bool QueueManager::publishable (const std::string& name)
+  {
+  return !reserved (name) && !TopicTrie::is_pattern (name);
+  }
+
+Queue* QueueManager::find_queue (std::string qn) 
   {
   // We don't support dynamic queue creation. TODO -- can we reject the 
   //   client connection if it does not provide a link address ?
@@ -70,18 +251,212 @@ void QueueManager::find_queue_for_sender (Sender* s, std::string qn)
     qn = "__NONAME__"; // This will lead to a client that gets no
                        //   messages. Not sure what else to do.
     }
-  Queue* q = 0;
-  QueueList::iterator i = queues.find(qn);
-  if (i == queues.end()) 
+  // The snapshot is held while the user is added, so the Queue can't
+  //   be disposed of in the meantime. If it is being removed, wait 
+  //   for the lock, and make a new one.
+    {
+    QueueSnapshot index = queues.get();
+    Queue* q = index->find (qn);
+    if (q && q->add_user()) return q;
+    }
+  return make_queue (qn, true);
+  }
+
+QueueSnapshot QueueManager::snapshot_for (const std::string &name)
+  {
+    {
+    QueueSnapshot index = queues.get();
+    if (name.empty() || index->find (name)) return index;
+    }
+  make_queue (name, false);
+  return queues.get();
+  }
+
+Queue* QueueManager::make_queue (const std::string &qn, bool user)
+  {
+  // Look again, now that we hold the lock -- another thread might 
+  //   have created the queue in the meantime. Queues are only retired
+  //   while the lock is held, and removed from the registry at the
+  //   same time, so any queue found now can be used.
+  std::lock_guard<std::mutex> l (create_lock);
+  QueueSnapshot index = queues.get();
+  Queue* q = index->find (qn);
+  if (q) 
+    {
+    if (user) q->add_user();
+    return q;
+    }
+  if (index->queues.size() >= max_queues && !evict (*index))
+    {
+    Stats::count (Stats::QUEUES_REFUSED);
+    // Publishers keep trying, so they would fill the log
+    if (user)
+      DWARN (log << "Can't create queue " << qn << ": there are already " 
+         << max_queues << " queues";)
+    else
+      DDBG (log << "Not keeping messages published to " << qn 
+         << ": there are already " << max_queues << " queues";)
+    return 0;
+    }
+
+  PolicyList::iterator p = policies.find (qn);
+  const QueuePolicy& policy = 
+    p == policies.end() ? default_policy : p->second;
+  Spool* spool = 0;
+  if (policy.spool)
     {
-    q = new Queue (container, qn);
-    queues[qn] = q;
-    } 
-  else 
+    std::string error;
+    spool = Spool::open (spool_dir + "/" + Spool::escape (qn), policy, 
+      error);
+    if (!spool)
+      DERR (log << "Can't open spool for queue " << qn << ": " 
+         << error;)
+    else
+      {
+      // Carry on numbering from the last message spooled, so that
+      //   clients can resume across a restart
+      std::atomic<uint64_t>& counter = shards[0]->sequence;
+      uint64_t next = spool->last() + 1;
+      uint64_t current = counter;
+      while (current < next 
+        && !counter.compare_exchange_weak (current, next));
+      }
+    }
+  ShmRing* ring = 0;
+  if (policy.shm && !shm_dir.empty())
+    {
+    std::string error;
+    ring = ShmRing::open (shm_dir + "/" NAME "." + Spool::escape (qn), 
+      policy.shm_slots, error);
+    if (!ring)
+      DERR (log << "Can't create shared memory ring for queue " << qn 
+         << ": " << error;)
+    }
+  q = new Queue (container, qn, policy, spool, ring);
+  if (user) q->add_user();
+  QueuePtr qp (q, [this] (Queue* q) { release_queue (q); });
+  Aggregator* a = Aggregator::parse (qn);
+  if (a)
     {
-    q = i->second;
+    DINFO (log << "Queue " << qn << " is derived from " 
+       << a->get_base();)
+    q->set_aggregator (a);
+    queues.add (qn, qp, a);
     }
-  s->add_work (make_work (&Sender::bind_to_queue, s, q, qn));
+  else
+    queues.add (qn, qp);
+  return q;
   }
 
+/*=====================================================================
+
+  evict
+
+  Make room for a new queue, when there are already max_queues, by 
+  removing the one that has been unused for longest. Only queues with
+  no users can go, so clients that are still subscribed, or 
+  publishing by name, are never affected. The caller holds the lock.
+
+=====================================================================*/
+bool QueueManager::evict (const QueueIndex& index)
+  {
+  uint64_t now = Stats::now();
+  QueueList::const_iterator oldest = index.queues.end();
+  uint64_t oldest_used = now;
+  for (QueueList::const_iterator i = index.queues.begin(); 
+        i != index.queues.end(); i++)
+    {
+    uint64_t used = i->second->last_used();
+    if (used && used < oldest_used)
+      {
+      oldest = i;
+      oldest_used = used;
+      }
+    }
+  if (oldest == index.queues.end() || !oldest->second->retire (now, 0, 0)) 
+    return false;
+  DINFO (log << "Reclaiming queue " << oldest->first 
+     << " to make room for another";)
+  queues.remove (std::vector<std::string> (1, oldest->first));
+  return true;
+  }
+
+/*=====================================================================
+
+  reclaim
+
+  A queue that is removed from the registry can still be in use by a
+  publisher that looked it up in an older snapshot. So it is only 
+  disposed of when the last snapshot that holds it has gone, and then
+  only after it has dealt with any messages already handed to it: 
+  release_queue() adds queue_drained() to the end of the Queue's work
+  queue, which asks for the Queue to be deleted on ours.
+
+=====================================================================*/
+void QueueManager::reclaim()
+  {
+  Stats::count (Stats::MANAGER_WORK_DONE);
+  uint64_t now = Stats::now();
+  std::vector<std::string> idle;
+    {
+    std::lock_guard<std::mutex> l (create_lock);
+    QueueSnapshot index = queues.get();
+    for (QueueList::const_iterator i = index->queues.begin(); 
+          i != index->queues.end(); i++)
+      if (i->second->retire (now, QUEUE_IDLE_GRACE * 1000000000ULL,
+            QUEUE_KEEP * 1000000000ULL))
+        idle.push_back (i->first);
+    if (!idle.empty()) 
+      queues.remove (idle);
+    else
+      // Free any snapshots that were in use at the last change
+      queues.collect();
+    }
+  for (size_t i = 0; i < idle.size(); i++)
+    DINFO (log << "Reclaiming idle queue " << idle[i];)
+  Stats::count (Stats::MANAGER_WORK_ADDED);
+  work_queue.schedule (proton::duration (QUEUE_RECLAIM_INTERVAL), 
+    proton::make_work (&QueueManager::reclaim, this));
+  }
+
+void QueueManager::release_queue (Queue* q)
+  {
+  // If the container has stopped, nothing else can use the Queue
+  if (!q->add_work (proton::make_work (&QueueManager::queue_drained, 
+        this, q)))
+    delete q;
+  }
+
+void QueueManager::queue_drained (Queue* q)
+  {
+  Stats::count (Stats::QUEUE_WORK_DONE);
+  // The Queue can't be deleted while its own work queue is running it
+  if (!add (proton::make_work (&QueueManager::delete_queue, this, q)))
+    delete q;
+  }
+
+void QueueManager::delete_queue (Queue* q)
+  {
+  Stats::count (Stats::MANAGER_WORK_DONE);
+  Stats::count (Stats::QUEUES_RECLAIMED);
+  delete q;
+  }
+
+void QueueManager::set_policy (const std::string &name, 
+       const QueuePolicy& p)
+  {
+  DDBG (log << "Queue " << name << " has slow-consumer policy " 
+     << QueuePolicy::name_of (p.slow_consumer) << ", buffer size " 
+     << p.buffer_size;)
+  if (name == "*")
+    default_policy = p;
+  else
+    {
+    policies[name] = p;
+    // Messages published before anybody subscribes must still be 
+    //   spooled, or written to shared memory, so the queue has to 
+    //   exist
+    if (p.spool || p.shm) find_queue (name);
+    }
+  }
 
@@ -24,12 +24,17 @@
 #include <proton/work_queue.hpp>
 
 #include <atomic>
+#include <mutex>
+#include <vector>
 
+#include "Metric.h"
 #include "Queue.h"
+#include "QueueRegistry.h"
+#include "Stats.h"
 
-/** It's convenient to define a new type to represent the
-    queue map -- particular when used with an iterator. */
-typedef std::map<std::string, Queue*> QueueList;
+/** The map of queue names to the policies that will be applied when
+    the queues are created. */
+typedef std::map<std::string, QueuePolicy> PolicyList;
 
 /** QueueManager is a singleton class that maintains a map
     linking queue names to Queue objects. */
@@ -45,13 +50,115 @@ class QueueManager
   /** My private work_queue. */
   proton::work_queue work_queue;
 
-  /** The set of queues being managed */
-  QueueList queues;
+  /** The set of queues being managed. This is read by publishers on
+      any thread, but only modified while holding create_lock. */
+  QueueRegistry queues;
 
-  /** Count of messages sent. This is used to generate the message ID.
-      Making it atomic reduces the likelihood that multiple messages 
-      will end up with the same ID, in a multi-threaded context. */
-  std::atomic<int> message_count;
+  /** The sequence number of the next message published. This is 
+      used as the message ID, and to replay messages to clients that
+      reconnect. It is atomic, so messages published from different 
+      threads never share a number. Only the first Shard's is used, 
+      so that a message has the same ID on every Shard. */
+  std::atomic<uint64_t> sequence;
+
+  /** Policies for specific queues, set from the command line. */
+  PolicyList policies;
+
+  /** The policy for queues that are not in the policies list. */
+  QueuePolicy default_policy;
+
+  /** Held while creating or removing a queue. The registry has only
+      one writer at a time. */
+  std::mutex create_lock;
+
+  /** The most queues there can be. When there are this many, one 
+      that nobody is using is evicted to make room for another. If 
+      they are all in use, no more are created. */
+  size_t max_queues;
+
+  /** The directory that holds the spools of queues whose policies ask
+      for them, each in a subdirectory named after the queue. */
+  std::string spool_dir;
+
+  /** The directory that holds the shared memory rings of queues whose
+      policies ask for them. If it is empty, this QueueManager makes no
+      rings. */
+  std::string shm_dir;
+
+  /** The QueueManagers of all the Server's Shards, including this 
+      one. Messages are published to all of them. */
+  std::vector<QueueManager*> shards;
+
+  /** Publish a text message, with optional application properties,
+      to the named queue. All the public publish() methods for text 
+      end up here. The message is encoded once, and delivered on 
+      every Shard. */
+  void publish_text (const std::string &name, const std::string &text,
+      const proton::message::property_map *properties, 
+      const FlowPtr &flow = FlowPtr());
+
+  /** Publish a Metric, with a structured body, to the queue with 
+      the Metric's name, on every Shard. */
+  void publish_metric (const Metric &m);
+
+  /** Find the queues that a message published to the named queue 
+      goes to, on this Shard, in a snapshot of the registry. The list
+      belongs to the calling thread, and is reused by the next call.
+      The Queues can only be used while the snapshot is held. */
+  std::vector<Queue*>& find_targets (const QueueIndex& index, 
+      const std::string &name);
+
+  /** Finish building a message, whose body and properties have been
+      set, giving it the next sequence number, and encode it into 
+      the Publication, which this method takes ownership of. */
+  PublicationPtr seal (const std::string &name, Publication* pub, 
+      proton::message& msg, uint64_t start, const FlowPtr &flow);
+
+  /** Hand a Publication to the Queues on this Shard that it goes to,
+      and pass its value, if it has one, to this Shard's 
+      Aggregators. */
+  void deliver (const PublicationPtr &p);
+
+  /** Pass the value of a message published to the named queue -- the
+      "value" property of a text message, or the value of a Metric --
+      to the queue's Aggregators, and publish any results to the 
+      derived queues. */
+  void aggregate (const QueueIndex& index, const std::string &name,
+      double value);
+
+  /** Take a snapshot of the registry that holds the queue with this
+      name, creating the queue if there isn't one, so that messages 
+      published to it are kept for clients that subscribe later. 
+      Without a name, or if there are too many queues, the snapshot
+      just doesn't have it. */
+  QueueSnapshot snapshot_for (const std::string &name);
+
+  /** Find or create the named queue, holding the lock, with a user 
+      added if user is set. Returns null if there are too many 
+      queues, and none can be evicted. */
+  Queue* make_queue (const std::string &qn, bool user);
+
+  /** Remove the queue that has had no users, and no messages, for
+      longest, to make room for a new one. Returns false if every 
+      queue is in use. The caller must hold the lock. */
+  bool evict (const QueueIndex& index);
+
+  /** Remove the queues that have had no users for QUEUE_IDLE_GRACE 
+      seconds, and no messages published to them for QUEUE_KEEP 
+      seconds, from the registry, and schedule the next run. This runs
+      on my work queue. */
+  void reclaim();
+
+  /** Called, on any thread, when the last registry snapshot that 
+      holds a Queue has gone, so no publisher can find it. */
+  void release_queue (Queue* q);
+
+  /** Run on the Queue's own work queue, after every message handed 
+      to it. */
+  void queue_drained (Queue* q);
+
+  /** Delete a Queue, on my work queue. */
+  void delete_queue (Queue* q);
 
 public:
 
@@ -60,21 +167,95 @@ public:
   /** Add a method call to my work queue. */
   bool add (proton::work f) 
     {
+    Stats::count (Stats::MANAGER_WORK_ADDED);
     return work_queue.add(f);
     }
 
   /** Publish a text message to the named queue. This method is
-      (I hope) thread safe. If there are subscribers on the queue,
-      they each get the message immediately. If there are none, the message
-      is lost. */
+      thread safe, and does not block: the queue is looked up in a
+      snapshot of the registry, and the message is handed to the 
+      Queue's work queue. If there are subscribers on the queue,
+      they each get the message. If there are none, the queue is 
+      created, if need be, and keeps it for later subscribers. */
   void publish (const std::string &name, const std::string &text);
 
+  /** Publish a text message with application properties. Clients 
+      can use message selectors to filter on the properties. */
+  void publish (const std::string &name, const std::string &text,
+      const proton::message::property_map &properties);
+
+  /** Publish a Metric. The message body is an AMQP list of its 
+      fields, and the value and labels are also application 
+      properties, so that clients can use selectors on them. */
+  void publish (const Metric &m);
+
+  /** Publish a message that a client sent on a Receiver link. The
+      Receiver's Flow is told how many Queues the message was handed
+      to, and each Queue tells it when it has fanned the message 
+      out. */
+  void publish (const std::string &name, const std::string &text,
+      const proton::message::property_map &properties, 
+      const FlowPtr &flow);
+
   /** Called from the ConnectionManager when a client creates a new
       link by which messages can be sent to it. This method either
       finds the Queue object for the clients queue name, or creates
-      it. It then calls bindToQueue() on the Sender, so that the 
-      Sender can assign itself to be the proton::messaging_handler
-      for the link. */
-  void find_queue_for_sender (Sender* s, std::string qn);
+      it. The queue name can be a wildcard pattern, like "host.net.*"
+      or "host.#", or the name of a derived queue like 
+      "loadavg.1.avg.60s", in which case an Aggregator is created to
+      feed it. This method is thread-safe. Finding an existing queue
+      does not lock; creating one does, so that two connections 
+      can't create the same queue. The ConnectionManager then binds
+      the Sender to the Queue straight away, on its own thread. 
+
+      The Queue is returned with a user added, which the caller must
+      remove with Queue::remove_user() when it is finished with the 
+      Queue. A Queue with no users, and no messages, for long enough 
+      is reclaimed. Returns null if the queue doesn't exist, and there
+      are too many queues in use to create it. */
+  Queue* find_queue (std::string qn);
+
+  /** Returns true if the named queue is reserved for the server, so
+      clients may not publish to it. */
+  static bool reserved (const std::string& name);
+
+  /** Returns true if clients, and other processes, may publish to the
+      named queue: it isn't reserved, and isn't a wildcard pattern, 
+      which would create a queue that matched the messages published
+      to other queues. */
+  static bool publishable (const std::string& name);
+
+  /** Set the policy that will be used when the named queue is
+      created. If the name is "*", set the default policy for all
+      queues that don't have a specific one. A queue whose policy asks
+      for a spool, or shared memory, is created at once, so that 
+      messages are written even when nobody has subscribed, and it is
+      never reclaimed. This method is not thread-safe,
+      and must be called before the server runs, and after 
+      set_spool_dir(). */
+  void set_policy (const std::string &name, const QueuePolicy& p);
+
+  /** Set the directory for queue spools. This method is not 
+      thread-safe, and must be called before the server runs. */
+  void set_spool_dir (const std::string &dir) { spool_dir = dir; }
+
+  /** Set the directory for shared memory rings, or turn them off, 
+      with an empty string. This method is not thread-safe, and must 
+      be called before the server runs. */
+  void set_shm_dir (const std::string &dir) { shm_dir = dir; }
+
+  /** Set the most queues there can be. This method is not 
+      thread-safe, and must be called before the server runs. */
+  void set_max_queues (size_t n) { max_queues = n; }
+
+  /** Start looking for idle queues to reclaim. This must be called 
+      once, before the server runs. */
+  void start();
+
+  /** Set the QueueManagers of all the Shards, including this one, 
+      that messages published to this QueueManager will be published
+      to. By default, there is only this one. This method is not 
+      thread-safe, and must be called before the server runs. */
+  void set_shards (const std::vector<QueueManager*>& s) { shards = s; }
   };
 
@@ -0,0 +1,149 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  QueuePolicy.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <stdlib.h>
+
+#include "QueuePolicy.h"
+#include "config.h"
+
+QueuePolicy::QueuePolicy() : 
+        slow_consumer (DEFAULT_SLOW_CONSUMER_POLICY),
+        buffer_size (DEFAULT_SENDER_BUFFER),
+        last_values (DEFAULT_LAST_VALUES),
+        replay_size (DEFAULT_REPLAY_SIZE),
+        conflate (false),
+        spool (false),
+        spool_size ((size_t)DEFAULT_SPOOL_MB * 1024 * 1024),
+        spool_age (DEFAULT_SPOOL_AGE),
+        shm (false),
+        shm_slots (DEFAULT_SHM_SLOTS)
+  {
+  }
+
+const char *QueuePolicy::name_of (SlowConsumerPolicy p)
+  {
+  switch (p)
+    {
+    case SLOW_DROP_OLDEST: return "drop-oldest";
+    case SLOW_DROP_NEWEST: return "drop-newest";
+    case SLOW_DISCONNECT: return "disconnect";
+    }
+  return "unknown";
+  }
+
+bool QueuePolicy::parse (const std::string &spec)
+  {
+  SlowConsumerPolicy scp = slow_consumer;
+  size_t size = buffer_size;
+  size_t last = last_values;
+  size_t replay = replay_size;
+  bool conf = conflate;
+  bool sp = spool;
+  size_t sp_size = spool_size;
+  unsigned long sp_age = spool_age;
+  bool sh = shm;
+  size_t sh_slots = shm_slots;
+
+  size_t start = 0;
+  while (start <= spec.size())
+    {
+    size_t end = spec.find (',', start);
+    if (end == std::string::npos) end = spec.size();
+    std::string item = spec.substr (start, end - start);
+    start = end + 1;
+    if (item.empty()) continue;
+
+    size_t eq = item.find ('=');
+    if (eq != std::string::npos)
+      {
+      // A setting, like last=5
+      std::string key = item.substr (0, eq);
+      std::string n = item.substr (eq + 1);
+      char *e = 0;
+      long l = strtol (n.c_str(), &e, 10);
+      if (n.empty() || *e != 0 || l < 0) return false;
+      if (key == "last") 
+        last = (size_t)l;
+      else if (key == "replay") 
+        replay = (size_t)l;
+      else if (key == "spool-mb" && l > 0) 
+        {
+        sp = true;
+        sp_size = (size_t)l * 1024 * 1024;
+        }
+      else if (key == "spool-age") 
+        {
+        sp = true;
+        sp_age = (unsigned long)l;
+        }
+      else if (key == "shm" && l > 0) 
+        {
+        sh = true;
+        sh_slots = (size_t)l;
+        }
+      else
+        return false;
+      continue;
+      }
+
+    if (item == "conflate")
+      {
+      conf = true;
+      continue;
+      }
+
+    if (item == "spool")
+      {
+      sp = true;
+      continue;
+      }
+
+    if (item == "shm")
+      {
+      sh = true;
+      continue;
+      }
+
+    // The slow-consumer policy, and perhaps the buffer size
+    std::string p = item;
+    size_t colon = item.find (':');
+    if (colon != std::string::npos)
+      {
+      p = item.substr (0, colon);
+      std::string n = item.substr (colon + 1);
+      char *e = 0;
+      long l = strtol (n.c_str(), &e, 10);
+      if (n.empty() || *e != 0 || l <= 0) return false;
+      size = (size_t)l;
+      }
+
+    if (p == "drop-oldest") 
+      scp = SLOW_DROP_OLDEST;
+    else if (p == "drop-newest") 
+      scp = SLOW_DROP_NEWEST;
+    else if (p == "disconnect") 
+      scp = SLOW_DISCONNECT;
+    else
+      return false;
+    }
+
+  slow_consumer = scp;
+  buffer_size = size;
+  last_values = last;
+  replay_size = replay;
+  conflate = conf;
+  spool = sp;
+  spool_size = sp_size;
+  spool_age = sp_age;
+  shm = sh;
+  shm_slots = sh_slots;
+  return true;
+  }
+
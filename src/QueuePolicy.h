@@ -0,0 +1,99 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  QueuePolicy.h
+
+  Per-queue settings that control how messages are delivered to
+  subscribers. A QueuePolicy is fixed when the Queue is created, and
+  never changes afterwards, so it can safely be read from any thread.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/** What a Sender should do when its outbound buffer is full, because
+    the client is not granting credit as fast as we are publishing. */
+enum SlowConsumerPolicy
+  {
+  /** Discard the oldest buffered message to make room. The client
+      sees the most recent messages, with a gap. */
+  SLOW_DROP_OLDEST,
+  /** Discard the message being sent. The client sees a gap after
+      the messages already buffered. */
+  SLOW_DROP_NEWEST,
+  /** Close the link with an error. The client will have to 
+      reconnect. */
+  SLOW_DISCONNECT
+  };
+
+class QueuePolicy
+  {
+  public:
+
+  /** What to do when a subscriber's outbound buffer overflows. */
+  SlowConsumerPolicy slow_consumer;
+
+  /** The number of messages each subscriber can have buffered, 
+      waiting for link credit. */
+  size_t buffer_size;
+
+  /** The number of recent messages the queue keeps, to deliver to 
+      each new subscriber as soon as it subscribes. Zero means new 
+      subscribers get only messages published after they subscribe. */
+  size_t last_values;
+
+  /** The number of recent messages the queue keeps, for clients 
+      that ask to resume from a particular sequence number when they
+      subscribe. */
+  size_t replay_size;
+
+  /** If set, a subscriber that is short of credit holds at most one
+      message for each conflation key: a newer message replaces the
+      older one where it stands in the buffer. Slow subscribers see
+      only the latest values; subscribers that keep up see them all. */
+  bool conflate;
+
+  /** If set, every message published to the queue is also written to
+      a Spool on disk, so clients can resume from messages published 
+      while they were away, not just those in the replay buffer. See
+      Spool.h. */
+  bool spool;
+
+  /** The most bytes of messages the spool keeps. */
+  size_t spool_size;
+
+  /** The oldest messages the spool keeps, in seconds. Zero means
+      there is no age limit. */
+  unsigned long spool_age;
+
+  /** If set, every message published to the queue is also written to
+      a ring in shared memory, for processes on the same host. See 
+      ShmRing.h. */
+  bool shm;
+
+  /** The number of slots in the shared memory ring. */
+  size_t shm_slots;
+
+  /** Constructor sets the defaults from config.h. */
+  QueuePolicy();
+
+  /** Parse a policy specification of the form 
+      "[policy[:buffer_size]][,last=N][,replay=N][,conflate][,spool]
+      [,spool-mb=N][,spool-age=S][,shm[=slots]]", for example 
+      "drop-oldest:100,last=5", and update this object. Setting 
+      spool-mb or spool-age turns on the spool. Settings that
+      are not given are unchanged. 
+      Returns false if the specification is invalid, in which case
+      this object is unchanged. */
+  bool parse (const std::string &spec);
+
+  /** Return the name of a SlowConsumerPolicy, for logging. */
+  static const char *name_of (SlowConsumerPolicy p);
+  };
+
@@ -0,0 +1,157 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  QueueRegistry.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include "QueueRegistry.h"
+
+std::atomic<QueueRegistry::Reader*> QueueRegistry::readers (0);
+std::atomic<uint64_t> QueueRegistry::epoch (1);
+
+QueueRegistry::QueueRegistry() : current (new QueueIndex())
+  {
+  }
+
+QueueRegistry::~QueueRegistry()
+  {
+  for (size_t i = 0; i < retired.size(); i++)
+    delete retired[i].second;
+  delete current.load();
+  }
+
+QueueRegistry::Reader &QueueRegistry::reader()
+  {
+  static thread_local Reader *r = 0;
+  if (r) return *r;
+  r = new Reader();
+  Reader *head = readers.load();
+  do
+    r->next = head;
+  while (!readers.compare_exchange_weak (head, r));
+  return *r;
+  }
+
+/*=====================================================================
+
+  enter
+
+  The Reader's epoch is stored before the current snapshot is loaded,
+  and a writer increments the epoch after it has replaced the 
+  snapshot, and then looks at the Readers. All are sequentially
+  consistent. So if a Reader gets an old snapshot, the writer sees 
+  the Reader's epoch, which is earlier than the one in which the 
+  snapshot was replaced; and if the Reader's epoch is that one or 
+  later, it gets the new snapshot.
+
+=====================================================================*/
+void QueueRegistry::enter()
+  {
+  Reader &r = reader();
+  if (r.depth++ == 0) r.epoch.store (epoch.load());
+  }
+
+void QueueRegistry::leave()
+  {
+  Reader &r = reader();
+  if (--r.depth == 0) r.epoch.store (0, std::memory_order_release);
+  }
+
+QueueSnapshot QueueRegistry::get() const
+  {
+  enter();
+  return QueueSnapshot (current.load());
+  }
+
+void QueueRegistry::replace (const QueueIndex* l)
+  {
+  const QueueIndex* old = current.exchange (l);
+  retired.push_back (std::make_pair (++epoch, old));
+  collect();
+  }
+
+void QueueRegistry::collect()
+  {
+  uint64_t oldest = UINT64_MAX;
+  for (Reader *r = readers.load(); r; r = r->next)
+    {
+    uint64_t e = r->epoch.load();
+    if (e != 0 && e < oldest) oldest = e;
+    }
+  // Deleting a snapshot can dispose of Queues, which is why the 
+  //   snapshots hold them
+  size_t n = 0;
+  while (n < retired.size() && retired[n].first <= oldest)
+    delete retired[n++].second;
+  retired.erase (retired.begin(), retired.begin() + n);
+  }
+
+Queue* QueueIndex::find (const std::string& name) const
+  {
+  QueueList::const_iterator i = queues.find (name);
+  if (i == queues.end()) return 0;
+  return i->second.get();
+  }
+
+void QueueIndex::match (const std::string& address, 
+      std::vector<Queue*>& out) const
+  {
+  QueueList::const_iterator i = queues.find (address);
+  if (i != queues.end()) out.push_back (i->second.get());
+  patterns.match (address, out);
+  }
+
+void QueueRegistry::add (const std::string& name, const QueuePtr& q)
+  {
+  // Copy the current snapshot, modify the copy, and publish it.
+  QueueIndex* l = new QueueIndex (*current.load());
+  l->queues[name] = q;
+  if (TopicTrie::is_pattern (name)) l->patterns.add (name, q.get());
+  replace (l);
+  }
+
+void QueueRegistry::add (const std::string& name, const QueuePtr& q, 
+      Aggregator* a)
+  {
+  QueueIndex* l = new QueueIndex (*current.load());
+  l->queues[name] = q;
+  l->aggregators[a->get_base()].push_back (a);
+  replace (l);
+  }
+
+void QueueRegistry::remove (const std::vector<std::string>& names)
+  {
+  QueueIndex* l = new QueueIndex (*current.load());
+  for (size_t i = 0; i < names.size(); i++)
+    l->queues.erase (names[i]);
+
+  // The trie can't remove patterns, so build a new one. This is rare.
+  l->patterns = TopicTrie();
+  for (QueueList::const_iterator i = l->queues.begin(); 
+        i != l->queues.end(); i++)
+    if (TopicTrie::is_pattern (i->first)) 
+      l->patterns.add (i->first, i->second.get());
+
+  for (AggregatorList::iterator i = l->aggregators.begin(); 
+        i != l->aggregators.end();)
+    {
+    std::vector<Aggregator*>& list = i->second;
+    for (size_t j = 0; j < list.size();)
+      {
+      if (l->queues.count (list[j]->get_derived()) == 0)
+        list.erase (list.begin() + j);
+      else
+        j++;
+      }
+    if (list.empty())
+      i = l->aggregators.erase (i);
+    else
+      i++;
+    }
+  replace (l);
+  }
+
@@ -0,0 +1,201 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  QueueRegistry.h
+
+  The QueueRegistry maps queue names to Queue objects. It is read on
+  every publish, from whatever thread is publishing, and written only
+  when a client subscribes to a queue that does not yet exist, or when
+  idle queues are reclaimed.
+
+  Readers never lock, and never wait for a writer: they read the 
+  pointer to the current snapshot of the map, which is immutable. 
+  A writer copies the current snapshot, changes the copy, and then 
+  publishes it as the new snapshot in a single atomic exchange. 
+  Readers that still hold the old snapshot carry on using it. This is
+  the "read-copy-update" pattern, and it works well when, as here, 
+  writes are rare.
+
+  An old snapshot is freed once no reader can be using it, which is
+  worked out from epochs. There is a global epoch number, which a
+  writer increments each time it replaces a snapshot. Each reading 
+  thread has a Reader, in which it records the epoch when it takes a
+  snapshot, and which it clears when it lets the snapshot go. A 
+  snapshot that was replaced in epoch n can be freed when no Reader
+  has an epoch earlier than n. Taking a snapshot costs two atomic 
+  loads and an atomic store, to memory that only the reading thread
+  writes -- unlike std::atomic_load() of a std::shared_ptr, which 
+  takes a lock.
+
+  Queues whose names are wildcard patterns are also indexed in a
+  TopicTrie, which is part of the same snapshot. So are the 
+  Aggregators that feed derived queues, indexed by the name of the
+  queue they summarize.
+
+  The snapshots share ownership of the Queues. A Queue that has been
+  removed is only finished with when the last snapshot that holds it
+  has gone, so a thread that looked the Queue up in a snapshot can use
+  it for as long as it holds the snapshot. The QueueManager supplies
+  the function that disposes of the Queue, when that happens.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Aggregator.h"
+#include "TopicTrie.h"
+
+class Queue;
+
+/** A Queue, shared by the snapshots that hold it. */
+typedef std::shared_ptr<Queue> QueuePtr;
+
+/** It's convenient to define a new type to represent the
+    queue map -- particular when used with an iterator. */
+typedef std::unordered_map<std::string, QueuePtr> QueueList;
+
+/** AggregatorList maps the name of a queue to the Aggregators that 
+    summarize it. */
+typedef std::unordered_map<std::string, std::vector<Aggregator*>> 
+  AggregatorList;
+
+/** A QueueIndex holds all the queues, by name, the wildcard
+    queues, by pattern, and the Aggregators. */
+class QueueIndex
+  {
+  public:
+  QueueList queues;
+  TopicTrie patterns;
+  AggregatorList aggregators;
+
+  /** Look up a queue by name. Returns null if there is no such queue.
+      Wildcards are not expanded -- a pattern is just a name here. */
+  Queue* find (const std::string& name) const;
+
+  /** Find all the queues that a message published to the address 
+      should go to: the queue with that exact name, if there is one,
+      and every wildcard queue whose pattern matches. The queues are 
+      added to out. They can only be used while the snapshot that 
+      this index belongs to is held. */
+  void match (const std::string& address, std::vector<Queue*>& out) const;
+  };
+
+class QueueSnapshot;
+
+class QueueRegistry
+  {
+  friend class QueueSnapshot;
+
+  private:
+
+  /** The state of one thread that reads registries. */
+  class Reader
+    {
+    public:
+    /** The epoch when the thread took the snapshots it holds, or 
+        zero if it holds none. */
+    std::atomic<uint64_t> epoch;
+    /** The number of snapshots the thread holds. A thread that 
+        already holds one can take another, from any registry, 
+        without changing its epoch. Only the thread itself uses 
+        this. */
+    int depth;
+    Reader *next;
+    Reader() : epoch (0), depth (0), next (0) {}
+    };
+
+  /** The list of all the Readers. New Readers are pushed on the 
+      front, and never removed, as for the Blocks in Stats. */
+  static std::atomic<Reader*> readers;
+
+  /** The current epoch, which starts at one. */
+  static std::atomic<uint64_t> epoch;
+
+  /** Get the calling thread's Reader, creating it the first time. */
+  static Reader &reader();
+
+  /** Start and finish using a snapshot, on the calling thread. */
+  static void enter();
+  static void leave();
+
+  /** The current snapshot. */
+  std::atomic<const QueueIndex*> current;
+
+  /** Snapshots that have been replaced, with the epochs in which they
+      were replaced, oldest first. Only writers use this. */
+  std::vector<std::pair<uint64_t, const QueueIndex*>> retired;
+
+  /** Make a new snapshot current, and retire the old one. */
+  void replace (const QueueIndex* l);
+
+  public:
+
+  QueueRegistry();
+
+  /** Free all the snapshots. Nothing must be using the registry. */
+  ~QueueRegistry();
+
+  /** Get the current snapshot. This method is thread-safe, and does
+      not lock. */
+  QueueSnapshot get() const;
+
+  /** Add a queue, publishing a new snapshot. This method is not 
+      thread-safe with respect to other writers: the caller must 
+      serialize calls to add(), for example by holding a lock. 
+      Readers are not affected. */
+  void add (const std::string& name, const QueuePtr& q);
+
+  /** Add a queue that is derived from another, and the Aggregator 
+      that feeds it, publishing a new snapshot. The same rules apply
+      as for add(). */
+  void add (const std::string& name, const QueuePtr& q, Aggregator* a);
+
+  /** Remove the named queues, and the Aggregators that feed them, 
+      publishing a new snapshot. The same rules apply as for add(). */
+  void remove (const std::vector<std::string>& names);
+
+  /** Free the retired snapshots that no reader can still be using.
+      Writers do this whenever they publish a snapshot, but a 
+      snapshot that was still in use then is only freed by a later 
+      call. The same rules apply as for add(). */
+  void collect();
+  };
+
+/** A QueueSnapshot is a reader's view of a QueueRegistry, which is 
+    immutable, and stays valid for as long as the QueueSnapshot 
+    exists. A QueueSnapshot can be moved, but not copied, and it must
+    be destroyed on the thread that took it. */
+class QueueSnapshot
+  {
+  friend class QueueRegistry;
+
+  private:
+
+  const QueueIndex* index;
+
+  QueueSnapshot (const QueueIndex* i) : index (i) {}
+
+  QueueSnapshot (const QueueSnapshot&) = delete;
+  QueueSnapshot& operator= (const QueueSnapshot&) = delete;
+
+  public:
+
+  QueueSnapshot (QueueSnapshot&& s) : index (s.index) { s.index = 0; }
+
+  ~QueueSnapshot() { if (index) QueueRegistry::leave(); }
+
+  const QueueIndex& operator*() const { return *index; }
+  const QueueIndex* operator->() const { return index; }
+  };
+
@@ -0,0 +1,137 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Receiver.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <proton/delivery.hpp>
+#include <proton/message.hpp>
+#include <proton/receiver.hpp>
+#include <proton/receiver_options.hpp>
+#include <proton/work_queue.hpp>
+
+#include <iostream>
+
+#include "Queue.h"
+#include "Receiver.h"
+#include "QueueManager.h"
+#include "Stats.h"
+#include "config.h"
+#include "logging.h"
+
+void Flow::drained()
+  {
+  int64_t n = --outstanding;
+  if (n > RECEIVER_WINDOW - RECEIVER_CREDIT_BATCH || !stalled) return;
+  std::lock_guard<std::mutex> l (lock);
+  // Only one Queue gets to wake the Receiver
+  if (closed || !stalled.exchange (false)) return;
+  work_queue->add (proton::make_work (&Receiver::replenish, 
+    shared_from_this()));
+  }
+
+Receiver::Receiver (proton::receiver r, const std::string& qn, 
+        Queue* q, QueueManager& qm, ReceiverList& rs) :
+        receiver (r), queue_name (qn), queue (q), queue_manager (&qm), 
+        receivers (&rs), flow (new Flow (&r.work_queue(), this))
+  {
+  DDBG (log << "Receiver object " << this << " for queue " << qn;)
+  // Credit is granted by top_up(), not automatically by Proton
+  receiver.open (proton::receiver_options()
+        .credit_window (0)
+        .handler (*this));
+  top_up();
+  }
+
+Receiver::~Receiver()
+  {
+  if (queue) queue->remove_user();
+  std::lock_guard<std::mutex> l (flow->lock);
+  flow->closed = true;
+  flow->receiver = 0;
+  }
+
+/*=====================================================================
+
+  top_up
+
+  The client's credit, plus the messages outstanding, is kept within
+  RECEIVER_WINDOW. Credit is only granted RECEIVER_CREDIT_BATCH or 
+  more at a time, so the client isn't sent a flow frame for every
+  message.
+
+=====================================================================*/
+void Receiver::top_up()
+  {
+  int credit = receiver.credit();
+  int64_t room = RECEIVER_WINDOW - flow->outstanding - credit;
+  if (room >= RECEIVER_CREDIT_BATCH)
+    {
+    receiver.add_credit ((uint32_t)room);
+    return;
+    }
+  if (credit > 0) return;
+
+  // The client can't send anything until the Queues catch up
+  Stats::count (Stats::RECEIVER_STALLS);
+  flow->stalled = true;
+  // The Queues may have caught up before we set stalled, in which case
+  //   none of them will wake us
+  if (RECEIVER_WINDOW - flow->outstanding >= RECEIVER_CREDIT_BATCH
+       && flow->stalled.exchange (false))
+    receiver.add_credit ((uint32_t)(RECEIVER_WINDOW - flow->outstanding));
+  }
+
+void Receiver::replenish (FlowPtr flow)
+  {
+  std::lock_guard<std::mutex> l (flow->lock);
+  if (flow->closed) return;
+  flow->receiver->top_up();
+  }
+
+/*=====================================================================
+
+  on_message
+
+=====================================================================*/
+void Receiver::on_message (proton::delivery &d, proton::message &m)
+  {
+  const std::string& name = queue_name.empty() ? m.to() : queue_name;
+  std::string text;
+  bool ok = !name.empty() && QueueManager::publishable (name);
+  if (ok)
+    {
+    try
+      {
+      text = proton::coerce<std::string> (m.body());
+      }
+    catch (const proton::conversion_error& e)
+      {
+      ok = false;
+      }
+    }
+  if (ok)
+    {
+    Stats::count (Stats::RECEIVED);
+    queue_manager->publish (name, text, m.properties(), flow);
+    }
+  else
+    {
+    DDBG (log << "Rejected message for queue \"" << name << "\"";)
+    Stats::count (Stats::RECEIVE_REJECTED);
+    d.reject();
+    }
+  top_up();
+  }
+
+void Receiver::on_receiver_close (proton::receiver &r)
+  {
+  DDBG (log << "Receiver closed " << r;)
+  receivers->erase (r);
+  delete this;
+  }
+
@@ -0,0 +1,143 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Receiver.h
+
+  A Receiver handles a link on which a client publishes messages to
+  the server. Each message is published to the queue named by the 
+  link's target address or, if the link has no address, by the 
+  message's "to" address, exactly as if the server had published it.
+  The message text is the message body, which must be a string; the
+  application properties are kept, so subscribers can use selectors
+  on them, and they feed derived queues as usual.
+
+  The client can only send as many messages as it has link credit 
+  for. The Receiver grants credit in batches, and only as the Queues
+  that the messages went to catch up. So a client that publishes 
+  faster than the Queues can fan messages out is slowed down, rather
+  than filling up the Queues' work queues.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <proton/delivery.hpp>
+#include <proton/message.hpp>
+#include <proton/messaging_handler.hpp>
+#include <proton/receiver.hpp>
+#include <proton/receiver_options.hpp>
+#include <proton/work_queue.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "Publication.h"
+
+class Queue;
+class QueueManager;
+class Receiver;
+
+typedef std::map<proton::receiver, Receiver*> ReceiverList;
+
+/** A Flow counts the messages that a Receiver has published, which 
+    the Queues have not yet fanned out. It is shared between the 
+    Receiver, on its connection's thread, and the Publications, which
+    are read by the Queues on theirs. It outlives the Receiver, if 
+    the Queues still have messages from it. */
+class Flow : public std::enable_shared_from_this<Flow>
+  {
+  friend class Receiver;
+
+  /** Messages handed to Queues, less messages fanned out. A message
+      published to several Queues counts once for each. */
+  std::atomic<int64_t> outstanding;
+
+  /** Set by the Receiver when the client has no credit left, and 
+      there are too many messages outstanding to grant more. The 
+      Queue that brings the count down far enough clears it, and 
+      wakes the Receiver. */
+  std::atomic<bool> stalled;
+
+  /** Protects closed, and the use of the work queue, which goes away
+      with the connection. */
+  std::mutex lock;
+
+  bool closed;
+
+  proton::work_queue* work_queue;
+
+  Receiver* receiver;
+
+  public:
+
+  Flow (proton::work_queue* wq, Receiver* r) : outstanding (0), 
+      stalled (false), closed (false), work_queue (wq), receiver (r)
+    {
+    }
+
+  /** Called by the QueueManager for each Queue a message is handed 
+      to. */
+  void handed (int64_t n) { outstanding += n; }
+
+  /** Called by a Queue when it has fanned out a message. This method
+      is thread-safe. */
+  void drained();
+  };
+
+class Receiver : public proton::messaging_handler
+  {
+  friend class Flow;
+
+  /** The Proton receiver that this object handles. */
+  proton::receiver receiver;
+
+  /** The queue named by the link's target, or empty if the client
+      names a queue in each message. */
+  std::string queue_name;
+
+  /** The queue named by the link's target, or null. This Receiver is
+      one of its users, so it isn't reclaimed while the link is 
+      open. */
+  Queue* queue;
+
+  QueueManager* queue_manager;
+
+  /** The ConnectionHandler's list of Receivers. */
+  ReceiverList* receivers;
+
+  FlowPtr flow;
+
+  /** Publish a message from the client. */
+  void on_message (proton::delivery &d, proton::message &m) override;
+
+  /** The client closed the link. Remove this object from the 
+      ConnectionHandler's list, and delete it. */
+  void on_receiver_close (proton::receiver &r) override;
+
+  /** Grant the client more credit, if the Queues have caught up far
+      enough. */
+  void top_up();
+
+  /** Run on the connection's work queue, when a stalled Flow has 
+      drained. */
+  static void replenish (FlowPtr flow);
+
+  public:
+
+  /** Create a Receiver for a link that a client has opened, and open
+      the link. If the link's target names a queue, q is that queue,
+      and the caller has added a user to it for this Receiver. */
+  Receiver (proton::receiver r, const std::string& qn, Queue* q,
+      QueueManager& qm, ReceiverList& rs);
+
+  /** The link is finished with, or its connection is gone. Any 
+      messages still outstanding are delivered, but nothing more is 
+      done for the link, and it stops using its queue. */
+  ~Receiver();
+  };
+
@@ -0,0 +1,105 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  RingBuffer.h
+
+  A simple fixed-capacity FIFO, backed by a vector that is allocated
+  once. Pushing and popping never allocate, so a RingBuffer can be
+  used on paths where we don't want the memory footprint to depend
+  on how fast (or slowly) somebody else is consuming. It is not
+  thread-safe -- the owner must serialize access, usually by only
+  touching it from its own work queue.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+template <class T> class RingBuffer
+  {
+  private:
+
+  /** Storage for the elements. Its size is the capacity. */
+  std::vector<T> slots;
+
+  /** Index of the oldest element. */
+  size_t head;
+
+  /** Number of elements currently stored. */
+  size_t count;
+
+  public:
+
+  RingBuffer (size_t capacity = 0) : slots (capacity), head (0), count (0)
+    {
+    }
+
+  /** Discard the contents, and change the capacity. This is the only
+      method that allocates. */
+  void reset (size_t capacity)
+    {
+    slots.assign (capacity, T());
+    head = 0;
+    count = 0;
+    }
+
+  size_t capacity() const { return slots.size(); }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  bool full() const { return count == slots.size(); }
+
+  /** Add an element at the back. The caller must check full() first --
+      pushing onto a full buffer overwrites the oldest element. */
+  void push_back (const T& t)
+    {
+    if (slots.empty()) return;
+    if (full()) pop_front();
+    slots[(head + count) % slots.size()] = t;
+    count++;
+    }
+
+  /** The oldest element. Undefined if the buffer is empty. */
+  T& front() { return slots[head]; }
+
+  /** The newest element. Undefined if the buffer is empty. */
+  T& back() { return slots[(head + count - 1) % slots.size()]; }
+
+  /** Remove the oldest element. The slot is overwritten with a default
+      value, so that anything it owned is released now, not when the
+      slot happens to get reused. */
+  void pop_front()
+    {
+    if (count == 0) return;
+    slots[head] = T();
+    head = (head + 1) % slots.size();
+    count--;
+    }
+
+  /** Remove the newest element. */
+  void pop_back()
+    {
+    if (count == 0) return;
+    back() = T();
+    count--;
+    }
+
+  /** Remove all elements, keeping the capacity. */
+  void clear()
+    {
+    while (count > 0) pop_front();
+    head = 0;
+    }
+
+  /** Element i, counting from the oldest (0) to the newest (size()-1). */
+  T& operator[] (size_t i) { return slots[(head + i) % slots.size()]; }
+  const T& operator[] (size_t i) const 
+    { 
+    return slots[(head + i) % slots.size()]; 
+    }
+  };
+
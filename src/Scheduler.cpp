@@ -0,0 +1,155 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Scheduler.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <errno.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <stdexcept>
+
+#include "Scheduler.h"
+#include "logging.h"
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_SEC 1000000000LL
+
+Scheduler::Scheduler (int resolution_ms, size_t slot_count) :
+        resolution (resolution_ms * NS_PER_MS), slots (slot_count), 
+        epoch (0), tick (0)
+  {
+  timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer_fd < 0)
+    throw std::runtime_error ((std::string) "Can't create timer: " 
+       + strerror (errno));
+  }
+
+Scheduler::~Scheduler()
+  {
+  close (timer_fd);
+  }
+
+int64_t Scheduler::now()
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+  }
+
+void Scheduler::add (const std::string& name, int interval_ms, Task task)
+  {
+  Entry e;
+  e.name = name;
+  e.task = task;
+  e.interval = interval_ms * NS_PER_MS;
+  if (e.interval < resolution) e.interval = resolution;
+  // Round up to a whole number of slots, so that a task's deadlines
+  //   always fall on the same slot boundaries.
+  e.interval = (e.interval + resolution - 1) / resolution * resolution;
+  e.deadline = 0;
+  e.missed = 0;
+  e.runs = 0;
+  entries.push_back (e);
+  }
+
+void Scheduler::insert (int e)
+  {
+  int64_t t = (entries[e].deadline - epoch) / resolution;
+  slots[t % slots.size()].push_back (e);
+  }
+
+void Scheduler::run_slot (int64_t t)
+  {
+  std::vector<int>& slot = slots[t % slots.size()];
+  int64_t slot_end = epoch + (t + 1) * resolution;
+  // Entries that are not yet due stay in the slot; entries that run 
+  //   are moved to the slot for their next deadline -- which might
+  //   be this one, if the interval is a whole revolution, so take them
+  //   all out first.
+  due.clear();
+  for (size_t i = 0; i < slot.size(); )
+    {
+    if (entries[slot[i]].deadline < slot_end)
+      {
+      due.push_back (slot[i]);
+      slot[i] = slot.back();
+      slot.pop_back();
+      }
+    else
+      i++;
+    }
+
+  for (size_t i = 0; i < due.size(); i++)
+    {
+    Entry& e = entries[due[i]];
+    e.task();
+    e.runs++;
+    int64_t next = e.deadline + e.interval;
+    int64_t n = now();
+    if (next <= n)
+      {
+      // We have fallen behind. Skip the deadlines that have already
+      //   passed, and count them.
+      int64_t missed = (n - e.deadline) / e.interval;
+      e.missed += missed;
+      next = e.deadline + (missed + 1) * e.interval;
+      DDBG (log << "Scheduler task missed deadline(s)";
+         log.field ("task", e.name).field ("missed", missed)
+           .field ("total", e.missed);)
+      }
+    e.deadline = next;
+    insert (due[i]);
+    }
+  }
+
+void Scheduler::run()
+  {
+  epoch = now();
+  tick = 0;
+  for (size_t i = 0; i < entries.size(); i++)
+    {
+    entries[i].deadline = epoch + entries[i].interval;
+    insert (i);
+    }
+
+  while (!entries.empty())
+    {
+    // Find the next slot that has anything in it. Every entry is in
+    //   some slot, so we will find one within a revolution.
+    int64_t next = tick;
+    while (slots[next % slots.size()].empty()) next++;
+
+    struct itimerspec its;
+    memset (&its, 0, sizeof (its));
+    int64_t wake = epoch + next * resolution;
+    its.it_value.tv_sec = wake / NS_PER_SEC;
+    its.it_value.tv_nsec = wake % NS_PER_SEC;
+    // A zero it_value would disarm the timer, rather than fire it
+    if (wake <= 0) its.it_value.tv_nsec = 1;
+    if (timerfd_settime (timer_fd, TFD_TIMER_ABSTIME, &its, 0) < 0)
+      throw std::runtime_error ((std::string) "Can't set timer: " 
+         + strerror (errno));
+
+    uint64_t expirations;
+    if (read (timer_fd, &expirations, sizeof (expirations)) < 0 
+          && errno != EINTR)
+      throw std::runtime_error ((std::string) "Can't read timer: " 
+         + strerror (errno));
+
+    // Process every slot up to the present, in case we slept longer
+    //   than we meant to.
+    int64_t current = (now() - epoch) / resolution;
+    for (; tick <= current; tick++)
+      run_slot (tick);
+    }
+  }
+
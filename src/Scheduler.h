@@ -0,0 +1,117 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Scheduler.h
+
+  The Scheduler runs tasks at fixed intervals, on the thread that 
+  calls run(). Each task has its own interval, which can be anything
+  from the scheduler's resolution (10 ms by default) up to minutes. 
+
+  Deadlines are absolute times on the monotonic clock: a task that
+  starts at time T with interval I is due at T+I, T+2I, T+3I... 
+  however long each run takes, so there is no cumulative drift. If a
+  task falls so far behind that one or more deadlines have passed 
+  before it can run, it runs once, the missed deadlines are counted,
+  and it continues from the next deadline in the future.
+
+  Tasks are held in a timing wheel -- a circular array of slots, one
+  per resolution period, each holding the tasks due in that period.
+  Scheduling a task is a constant-time operation, however many tasks
+  there are. A task due more than one revolution of the wheel in the
+  future sits in its slot, and is skipped until its time comes.
+
+  The thread sleeps on a timerfd, armed with an absolute time on
+  CLOCK_MONOTONIC, and wakes only when a slot with tasks in it comes
+  round.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Scheduler
+  {
+  public:
+
+  /** A task is any function with no arguments and no result. */
+  typedef std::function<void()> Task;
+
+  private:
+
+  class Entry
+    {
+    public:
+    std::string name;
+    Task task;
+    /** Interval and next deadline, in nanoseconds. */
+    int64_t interval;
+    int64_t deadline;
+    /** The number of deadlines that passed without the task being 
+        run. */
+    uint64_t missed;
+    /** The number of times the task has run. */
+    uint64_t runs;
+    };
+
+  int timer_fd;
+
+  /** Resolution, in nanoseconds. */
+  int64_t resolution;
+
+  std::vector<Entry> entries;
+
+  /** The wheel. Each slot holds the indices of the entries whose 
+      deadlines fall in that slot's resolution period, in this or a 
+      later revolution. */
+  std::vector<std::vector<int> > slots;
+
+  /** The entries being run by run_slot(). This is a member only so
+      that its storage gets reused. */
+  std::vector<int> due;
+
+  /** The monotonic time at which the wheel started, in nanoseconds.
+      Slot boundaries are multiples of the resolution from here. */
+  int64_t epoch;
+
+  /** The number of resolution periods, since the epoch, that have
+      been processed. */
+  int64_t tick;
+
+  static int64_t now();
+
+  /** Put an entry into the slot for its deadline. */
+  void insert (int e);
+
+  /** Run the tasks in the slot for the given tick that are due. */
+  void run_slot (int64_t t);
+
+  public:
+
+  /** Create a scheduler with the given resolution in milliseconds,
+      and number of slots in its wheel. */
+  Scheduler (int resolution_ms, size_t slot_count);
+
+  ~Scheduler();
+
+  /** Add a task, to be run every interval_ms milliseconds, the first
+      time one interval after run() is called. The interval is 
+      rounded up to the resolution. Tasks must all be added before 
+      run() is called. */
+  void add (const std::string& name, int interval_ms, Task task);
+
+  /** Run the tasks, forever. */
+  void run();
+
+  private:
+  Scheduler (const Scheduler&);
+  Scheduler& operator= (const Scheduler&);
+  };
+
@@ -0,0 +1,736 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Selector.cpp
+
+  The parser is a straightforward recursive-descent parser, with one
+  method per level of operator precedence, from lowest to highest:
+
+    or      := and { OR and }
+    and     := not { AND not }
+    not     := NOT not | compare
+    compare := sum [ (= | <> | < | <= | > | >=) sum 
+                   | IS [NOT] NULL 
+                   | [NOT] BETWEEN sum AND sum 
+                   | [NOT] IN ( literal { , literal } ) 
+                   | [NOT] LIKE string [ESCAPE string] ]
+    sum     := product { (+ | -) product }
+    product := unary { (* | /) unary }
+    unary   := (+ | -) unary | primary
+    primary := number | string | TRUE | FALSE | identifier | ( or )
+
+  The client supplies the selector, so the parser limits how deeply
+  expressions can be nested, and how many nodes the tree can have. 
+  Both the parser and Selector::eval() recurse, and the node count 
+  also limits how deep a long chain like "a=1 OR a=1 OR ..." makes 
+  the tree.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <proton/codec/decoder.hpp>
+#include <proton/message.hpp>
+#include <proton/scalar.hpp>
+#include <proton/source.hpp>
+#include <proton/value.hpp>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <stdexcept>
+
+#include "Selector.h"
+#include "config.h"
+
+/*=====================================================================
+
+  SelectorParser
+
+=====================================================================*/
+class SelectorParser
+  {
+  private:
+
+  enum Token 
+    { 
+    T_END, T_IDENT, T_NUMBER, T_STRING, T_LPAREN, T_RPAREN, T_COMMA,
+    T_EQ, T_NE, T_LT, T_LE, T_GT, T_GE, T_PLUS, T_MINUS, T_STAR, T_SLASH,
+    T_AND, T_OR, T_NOT, T_IS, T_NULL, T_BETWEEN, T_IN, T_LIKE, T_ESCAPE,
+    T_TRUE, T_FALSE
+    };
+
+  Selector& sel;
+  const std::string& text;
+  size_t pos;
+
+  /** How many NOTs, signs and parentheses enclose the current 
+      position. */
+  int depth;
+
+  /** The current token, and its text (for identifiers, numbers and 
+      strings). */
+  Token token;
+  std::string token_text;
+
+  void fail (const std::string& why)
+    {
+    char s[20];
+    snprintf (s, sizeof (s), "%d", (int)pos);
+    throw std::runtime_error (why + " at offset " + s);
+    }
+
+  /** Read the next token. */
+  void next();
+
+  bool accept (Token t)
+    {
+    if (token != t) return false;
+    next();
+    return true;
+    }
+
+  void expect (Token t, const char *what)
+    {
+    if (!accept (t)) fail ((std::string)"expected " + what);
+    }
+
+  /** Call before parsing a nested expression, and unnest() after. */
+  void nest()
+    {
+    if (++depth > SELECTOR_MAX_DEPTH) fail ("selector is nested too deeply");
+    }
+
+  void unnest() { depth--; }
+
+  int add (const Selector::Node& n)
+    {
+    if (sel.nodes.size() >= SELECTOR_MAX_NODES) 
+      fail ("selector is too long");
+    return sel.add (n);
+    }
+
+  int literal();
+  int parse_or();
+  int parse_and();
+  int parse_not();
+  int parse_compare();
+  int parse_sum();
+  int parse_product();
+  int parse_unary();
+  int parse_primary();
+
+  int binary (Selector::Op op, int l, int r)
+    {
+    Selector::Node n (op);
+    n.args.push_back (l);
+    n.args.push_back (r);
+    return add (n);
+    }
+
+  public:
+
+  SelectorParser (Selector& s, const std::string& t) : 
+      sel (s), text (t), pos (0), depth (0), token (T_END) 
+    {
+    }
+
+  void parse()
+    {
+    next();
+    sel.root = parse_or();
+    if (token != T_END) fail ("unexpected text");
+    }
+  };
+
+void SelectorParser::next()
+  {
+  while (pos < text.size() && isspace ((unsigned char)text[pos])) pos++;
+  token_text.clear();
+  if (pos >= text.size()) 
+    {
+    token = T_END;
+    return;
+    }
+
+  char c = text[pos];
+  if (isalpha ((unsigned char)c) || c == '_' || c == '$')
+    {
+    size_t start = pos;
+    while (pos < text.size() && (isalnum ((unsigned char)text[pos]) || 
+          text[pos] == '_' || text[pos] == '$' || text[pos] == '.'))
+      pos++;
+    token_text = text.substr (start, pos - start);
+    static const struct { const char *word; Token token; } keywords[] =
+      {
+      {"AND", T_AND}, {"OR", T_OR}, {"NOT", T_NOT}, {"IS", T_IS},
+      {"NULL", T_NULL}, {"BETWEEN", T_BETWEEN}, {"IN", T_IN},
+      {"LIKE", T_LIKE}, {"ESCAPE", T_ESCAPE}, {"TRUE", T_TRUE},
+      {"FALSE", T_FALSE}, {0, T_END}
+      };
+    token = T_IDENT;
+    for (int i = 0; keywords[i].word; i++)
+      {
+      if (strcasecmp (token_text.c_str(), keywords[i].word) == 0)
+        token = keywords[i].token;
+      }
+    return;
+    }
+
+  if (isdigit ((unsigned char)c) || 
+       (c == '.' && pos + 1 < text.size() && 
+         isdigit ((unsigned char)text[pos + 1])))
+    {
+    const char *start = text.c_str() + pos;
+    char *end = 0;
+    strtod (start, &end);
+    token_text = text.substr (pos, end - start);
+    pos += end - start;
+    // JMS allows a trailing L, F or D type suffix
+    if (pos < text.size() && strchr ("lLfFdD", text[pos])) pos++;
+    token = T_NUMBER;
+    return;
+    }
+
+  if (c == '\'')
+    {
+    pos++;
+    while (true)
+      {
+      if (pos >= text.size()) fail ("unterminated string");
+      if (text[pos] == '\'')
+        {
+        // '' is an escaped quote
+        if (pos + 1 < text.size() && text[pos + 1] == '\'')
+          pos++;
+        else
+          break;
+        }
+      token_text += text[pos++];
+      }
+    pos++;
+    token = T_STRING;
+    return;
+    }
+
+  pos++;
+  switch (c)
+    {
+    case '(': token = T_LPAREN; return;
+    case ')': token = T_RPAREN; return;
+    case ',': token = T_COMMA; return;
+    case '=': token = T_EQ; return;
+    case '+': token = T_PLUS; return;
+    case '-': token = T_MINUS; return;
+    case '*': token = T_STAR; return;
+    case '/': token = T_SLASH; return;
+    case '<':
+      if (pos < text.size() && text[pos] == '>') { pos++; token = T_NE; }
+      else if (pos < text.size() && text[pos] == '=') 
+        { pos++; token = T_LE; }
+      else token = T_LT;
+      return;
+    case '>':
+      if (pos < text.size() && text[pos] == '=') { pos++; token = T_GE; }
+      else token = T_GT;
+      return;
+    }
+  pos--;
+  fail ("unexpected character");
+  }
+
+int SelectorParser::literal()
+  {
+  Selector::Node n (Selector::LITERAL);
+  if (token == T_STRING)
+    {
+    n.value.type = Selector::Value::STRING;
+    n.value.s = token_text;
+    }
+  else if (token == T_NUMBER)
+    {
+    n.value.type = Selector::Value::NUMBER;
+    n.value.n = strtod (token_text.c_str(), 0);
+    }
+  else if (token == T_TRUE || token == T_FALSE)
+    {
+    n.value.type = Selector::Value::BOOL;
+    n.value.b = (token == T_TRUE);
+    }
+  else
+    fail ("expected a literal");
+  next();
+  return add (n);
+  }
+
+int SelectorParser::parse_or()
+  {
+  int l = parse_and();
+  while (accept (T_OR))
+    l = binary (Selector::OR, l, parse_and());
+  return l;
+  }
+
+int SelectorParser::parse_and()
+  {
+  int l = parse_not();
+  while (accept (T_AND))
+    l = binary (Selector::AND, l, parse_not());
+  return l;
+  }
+
+int SelectorParser::parse_not()
+  {
+  if (accept (T_NOT))
+    {
+    Selector::Node n (Selector::NOT);
+    nest();
+    n.args.push_back (parse_not());
+    unnest();
+    return add (n);
+    }
+  return parse_compare();
+  }
+
+int SelectorParser::parse_compare()
+  {
+  int l = parse_sum();
+  switch (token)
+    {
+    case T_EQ: next(); return binary (Selector::EQ, l, parse_sum());
+    case T_NE: next(); return binary (Selector::NE, l, parse_sum());
+    case T_LT: next(); return binary (Selector::LT, l, parse_sum());
+    case T_LE: next(); return binary (Selector::LE, l, parse_sum());
+    case T_GT: next(); return binary (Selector::GT, l, parse_sum());
+    case T_GE: next(); return binary (Selector::GE, l, parse_sum());
+    default: break;
+    }
+
+  if (accept (T_IS))
+    {
+    Selector::Node n (Selector::IS_NULL);
+    n.negate = accept (T_NOT);
+    expect (T_NULL, "NULL");
+    n.args.push_back (l);
+    return add (n);
+    }
+
+  bool negate = accept (T_NOT);
+  if (accept (T_BETWEEN))
+    {
+    Selector::Node n (Selector::BETWEEN);
+    n.negate = negate;
+    n.args.push_back (l);
+    n.args.push_back (parse_sum());
+    expect (T_AND, "AND");
+    n.args.push_back (parse_sum());
+    return add (n);
+    }
+  if (accept (T_IN))
+    {
+    Selector::Node n (Selector::IN);
+    n.negate = negate;
+    n.args.push_back (l);
+    expect (T_LPAREN, "(");
+    do
+      n.args.push_back (literal());
+    while (accept (T_COMMA));
+    expect (T_RPAREN, ")");
+    return add (n);
+    }
+  if (accept (T_LIKE))
+    {
+    Selector::Node n (Selector::LIKE);
+    n.negate = negate;
+    n.args.push_back (l);
+    if (token != T_STRING) fail ("expected a pattern");
+    n.value.type = Selector::Value::STRING;
+    n.value.s = token_text;
+    next();
+    if (accept (T_ESCAPE))
+      {
+      if (token != T_STRING || token_text.size() != 1) 
+        fail ("expected a single escape character");
+      n.escape = token_text[0];
+      next();
+      }
+    return add (n);
+    }
+  if (negate) fail ("expected BETWEEN, IN or LIKE");
+  return l;
+  }
+
+int SelectorParser::parse_sum()
+  {
+  int l = parse_product();
+  while (true)
+    {
+    if (accept (T_PLUS)) 
+      l = binary (Selector::ADD, l, parse_product());
+    else if (accept (T_MINUS)) 
+      l = binary (Selector::SUB, l, parse_product());
+    else 
+      return l;
+    }
+  }
+
+int SelectorParser::parse_product()
+  {
+  int l = parse_unary();
+  while (true)
+    {
+    if (accept (T_STAR)) 
+      l = binary (Selector::MUL, l, parse_unary());
+    else if (accept (T_SLASH)) 
+      l = binary (Selector::DIV, l, parse_unary());
+    else 
+      return l;
+    }
+  }
+
+int SelectorParser::parse_unary()
+  {
+  if (accept (T_PLUS)) 
+    {
+    nest();
+    int n = parse_unary();
+    unnest();
+    return n;
+    }
+  if (accept (T_MINUS))
+    {
+    Selector::Node n (Selector::NEG);
+    nest();
+    n.args.push_back (parse_unary());
+    unnest();
+    return add (n);
+    }
+  return parse_primary();
+  }
+
+int SelectorParser::parse_primary()
+  {
+  if (accept (T_LPAREN))
+    {
+    nest();
+    int n = parse_or();
+    unnest();
+    expect (T_RPAREN, ")");
+    return n;
+    }
+  if (token == T_IDENT)
+    {
+    Selector::Node n (Selector::PROPERTY);
+    n.value.type = Selector::Value::STRING;
+    n.value.s = token_text;
+    next();
+    return add (n);
+    }
+  return literal();
+  }
+
+/*=====================================================================
+
+  Selector
+
+=====================================================================*/
+
+Selector* Selector::compile (const std::string& text, std::string& error)
+  {
+  Selector* s = new Selector();
+  s->text = text;
+  try
+    {
+    SelectorParser (*s, text).parse();
+    }
+  catch (const std::exception& e)
+    {
+    error = e.what();
+    delete s;
+    return 0;
+    }
+  return s;
+  }
+
+bool Selector::find (const proton::source::filter_map& filters, 
+      std::string& text)
+  {
+  static const char *keys[] = { "jms-selector", "selector", 0 };
+  for (int i = 0; keys[i]; i++)
+    {
+    proton::symbol key (keys[i]);
+    if (!filters.exists (key)) continue;
+    proton::value v = filters.get (key);
+    try
+      {
+      if (v.type() == proton::STRING)
+        {
+        text = proton::get<std::string> (v);
+        return true;
+        }
+      // The filter should be a described type, with the selector
+      //   text as the value, e.g.
+      //   apache.org:selector-filter:string "severity > 2"
+      proton::codec::decoder d (v);
+      proton::codec::start s;
+      d >> s;
+      if (!s.is_described) continue;
+      proton::value descriptor;
+      d >> descriptor >> text >> proton::codec::finish();
+      return true;
+      }
+    catch (const proton::error&)
+      {
+      // Not a filter we understand
+      }
+    }
+  return false;
+  }
+
+/** Match a string against a LIKE pattern, in which '%' matches any
+    sequence of characters, and '_' any single character. When a 
+    character doesn't match, only the last '%' is retried, one 
+    character further on, so this takes at most the product of the 
+    lengths, however many '%'s there are. */
+static bool like (const char *s, const char *p, char escape)
+  {
+  // The pattern after the last '%', and where in s it is tried next
+  const char *star = 0;
+  const char *retry = 0;
+  while (*s)
+    {
+    if (*p && *p == escape && p[1])
+      {
+      if (*s == p[1])
+        {
+        s++;
+        p += 2;
+        continue;
+        }
+      }
+    else if (*p == '%')
+      {
+      while (*p == '%') p++;
+      star = p;
+      retry = s;
+      continue;
+      }
+    else if (*p && (*p == '_' || *p == *s))
+      {
+      s++;
+      p++;
+      continue;
+      }
+    if (!star) return false;
+    p = star;
+    s = ++retry;
+    }
+  while (*p == '%') p++;
+  return *p == 0;
+  }
+
+/** Compare two values. Returns false if they cannot be compared, 
+    otherwise sets cmp to -1, 0 or 1. */
+static bool compare (const Selector::Value& a, const Selector::Value& b,
+      int& cmp)
+  {
+  if (a.type != b.type || a.type == Selector::Value::NONE) return false;
+  switch (a.type)
+    {
+    case Selector::Value::NUMBER:
+      cmp = a.n < b.n ? -1 : (a.n > b.n ? 1 : 0);
+      return true;
+    case Selector::Value::STRING:
+      cmp = a.s.compare (b.s);
+      cmp = cmp < 0 ? -1 : (cmp > 0 ? 1 : 0);
+      return true;
+    case Selector::Value::BOOL:
+      cmp = (int)a.b - (int)b.b;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+static void set_bool (Selector::Value& v, bool b)
+  {
+  v.type = Selector::Value::BOOL;
+  v.b = b;
+  }
+
+void Selector::eval (int i, const PropertyMap& props, Value& result) const
+  {
+  const Node& n = nodes[i];
+  result.type = Value::NONE;
+
+  switch (n.op)
+    {
+    case LITERAL:
+      result = n.value;
+      return;
+
+    case PROPERTY:
+      {
+      PropertyMap::const_iterator p = props.find (n.value.s);
+      if (p == props.end()) return;
+      const proton::scalar& v = p->second;
+      try
+        {
+        switch (v.type())
+          {
+          case proton::BOOLEAN:
+            set_bool (result, proton::get<bool> (v));
+            break;
+          case proton::STRING:
+          case proton::SYMBOL:
+            result.type = Value::STRING;
+            result.s = proton::coerce<std::string> (v);
+            break;
+          case proton::UBYTE: case proton::BYTE: case proton::USHORT:
+          case proton::SHORT: case proton::UINT: case proton::INT:
+          case proton::ULONG: case proton::LONG: case proton::FLOAT:
+          case proton::DOUBLE: case proton::TIMESTAMP:
+            result.type = Value::NUMBER;
+            result.n = proton::coerce<double> (v);
+            break;
+          default:
+            break;
+          }
+        }
+      catch (const proton::error&)
+        {
+        result.type = Value::NONE;
+        }
+      return;
+      }
+
+    case AND:
+    case OR:
+      {
+      // Three-valued logic: for AND, false wins over unknown; for OR,
+      //   true wins over unknown.
+      bool decisive = (n.op == OR);
+      Value l, r;
+      eval (n.args[0], props, l);
+      if (l.type == Value::BOOL && l.b == decisive) 
+        {
+        set_bool (result, decisive);
+        return;
+        }
+      eval (n.args[1], props, r);
+      if (r.type == Value::BOOL && r.b == decisive) 
+        set_bool (result, decisive);
+      else if (l.type == Value::BOOL && r.type == Value::BOOL)
+        set_bool (result, !decisive);
+      return;
+      }
+
+    case NOT:
+      eval (n.args[0], props, result);
+      if (result.type == Value::BOOL) 
+        result.b = !result.b;
+      else
+        result.type = Value::NONE;
+      return;
+
+    case EQ: case NE: case LT: case LE: case GT: case GE:
+      {
+      Value l, r;
+      int cmp;
+      eval (n.args[0], props, l);
+      eval (n.args[1], props, r);
+      if (!compare (l, r, cmp)) return;
+      switch (n.op)
+        {
+        case EQ: set_bool (result, cmp == 0); break;
+        case NE: set_bool (result, cmp != 0); break;
+        case LT: set_bool (result, cmp < 0); break;
+        case LE: set_bool (result, cmp <= 0); break;
+        case GT: set_bool (result, cmp > 0); break;
+        default: set_bool (result, cmp >= 0); break;
+        }
+      return;
+      }
+
+    case ADD: case SUB: case MUL: case DIV:
+      {
+      Value l, r;
+      eval (n.args[0], props, l);
+      eval (n.args[1], props, r);
+      if (l.type != Value::NUMBER || r.type != Value::NUMBER) return;
+      if (n.op == DIV && r.n == 0) return;
+      result.type = Value::NUMBER;
+      switch (n.op)
+        {
+        case ADD: result.n = l.n + r.n; break;
+        case SUB: result.n = l.n - r.n; break;
+        case MUL: result.n = l.n * r.n; break;
+        default: result.n = l.n / r.n; break;
+        }
+      return;
+      }
+
+    case NEG:
+      eval (n.args[0], props, result);
+      if (result.type == Value::NUMBER) 
+        result.n = -result.n;
+      else
+        result.type = Value::NONE;
+      return;
+
+    case IS_NULL:
+      eval (n.args[0], props, result);
+      set_bool (result, (result.type == Value::NONE) != n.negate);
+      return;
+
+    case BETWEEN:
+      {
+      Value x, lo, hi;
+      int c1, c2;
+      eval (n.args[0], props, x);
+      eval (n.args[1], props, lo);
+      eval (n.args[2], props, hi);
+      if (!compare (x, lo, c1) || !compare (x, hi, c2)) return;
+      set_bool (result, (c1 >= 0 && c2 <= 0) != n.negate);
+      return;
+      }
+
+    case IN:
+      {
+      Value x;
+      eval (n.args[0], props, x);
+      if (x.type == Value::NONE) return;
+      bool found = false;
+      for (size_t a = 1; a < n.args.size() && !found; a++)
+        {
+        int cmp;
+        if (compare (x, nodes[n.args[a]].value, cmp) && cmp == 0) 
+          found = true;
+        }
+      set_bool (result, found != n.negate);
+      return;
+      }
+
+    case LIKE:
+      {
+      Value x;
+      eval (n.args[0], props, x);
+      if (x.type != Value::STRING) return;
+      set_bool (result, 
+        like (x.s.c_str(), n.value.s.c_str(), n.escape) != n.negate);
+      return;
+      }
+    }
+  }
+
+bool Selector::matches (const PropertyMap& props) const
+  {
+  Value v;
+  eval (root, props, v);
+  return v.type == Value::BOOL && v.b;
+  }
+
@@ -0,0 +1,132 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Selector.h
+
+  A Selector is a compiled message selector, of the kind used by JMS
+  clients to filter the messages they receive. A client supplies the
+  selector as a filter on the source of the link it opens, and the
+  server sends it only the messages whose properties match. For
+  example:
+
+    severity > 2 AND host LIKE 'web%'
+
+  The selector text is parsed once, when the link is opened, into an
+  expression tree. Evaluating the tree against a message's
+  application properties is then just a walk over a small vector of
+  nodes.
+
+  This is a subset of the JMS selector language: comparisons 
+  (= <> < <= > >=), arithmetic (+ - * /), AND, OR, NOT, IS [NOT] NULL, 
+  [NOT] BETWEEN, [NOT] IN, [NOT] LIKE (with ESCAPE), and string, 
+  numeric and boolean literals. Identifiers refer to message 
+  application properties. As in JMS, a property that is missing makes
+  any comparison involving it "unknown", and a message only matches
+  if the selector is definitely true.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <proton/message.hpp>
+#include <proton/source.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Publication.h"
+
+class Selector
+  {
+  public:
+
+  /** The kinds of node in the expression tree. */
+  enum Op
+    {
+    LITERAL, PROPERTY, 
+    AND, OR, NOT, 
+    EQ, NE, LT, LE, GT, GE,
+    ADD, SUB, MUL, DIV, NEG,
+    IS_NULL, BETWEEN, IN, LIKE
+    };
+
+  /** A value, as produced by evaluating a node. The type NONE stands 
+      for SQL "NULL", or for "unknown" in a logical expression. */
+  class Value
+    {
+    public:
+    enum Type { NONE, BOOL, NUMBER, STRING };
+    Type type;
+    bool b;
+    double n;
+    std::string s;
+    Value() : type (NONE), b (false), n (0) {}
+    };
+
+  private:
+
+  class Node
+    {
+    public:
+    Op op;
+    /** Negate the result -- for NOT BETWEEN, NOT IN, NOT LIKE and
+        IS NOT NULL. */
+    bool negate;
+    /** The value of a LITERAL, the name of a PROPERTY, or the 
+        pattern of a LIKE. */
+    Value value;
+    /** The escape character of a LIKE, or 0. */
+    char escape;
+    /** Indexes of the operand nodes. For IN, all the nodes after
+        the first are the list members. */
+    std::vector<int> args;
+    Node (Op o) : op (o), negate (false), escape (0) {}
+    };
+
+  /** All the nodes. The root is the last one added. */
+  std::vector<Node> nodes;
+
+  /** The root node. */
+  int root;
+
+  /** The original selector text. */
+  std::string text;
+
+  Selector() : root (-1) {}
+
+  int add (const Node& n) 
+    { 
+    nodes.push_back (n); 
+    return (int)nodes.size() - 1; 
+    }
+
+  void eval (int n, const PropertyMap& props, Value& result) const;
+
+  friend class SelectorParser;
+
+  public:
+
+  /** Compile a selector. Returns null if the selector is invalid, 
+      and sets error to a description of the problem. The caller owns
+      the returned object. */
+  static Selector* compile (const std::string& text, std::string& error);
+
+  /** Look for a selector in a link's source filters, and return its 
+      text. Returns false if there isn't one. Both the "jms-selector" 
+      key used by Qpid JMS, and the "selector" key used by the Proton 
+      examples, are recognized. */
+  static bool find (const proton::source::filter_map& filters, 
+      std::string& text);
+
+  /** Returns true if a message's properties match this selector. 
+      This method does not modify the Selector, so it can be called
+      on any thread. */
+  bool matches (const PropertyMap& props) const;
+
+  /** Get the original text of the selector. */
+  const std::string& get_text() const { return text; }
+  };
+
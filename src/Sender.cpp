@@ -20,6 +20,8 @@
 #include <proton/source_options.hpp>
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
+#include <proton/codec/encoder.hpp>
+#include <proton/duration.hpp>
 
 #include <iostream>
 #include <ostream>
@@ -27,50 +29,379 @@
 
 #include "Sender.h"
 #include "Queue.h"
+#include "config.h"
 #include "logging.h"
 
-Sender::Sender (proton::sender s, SenderList& ss) :
-        sender(s), senders(ss), work_queue(s.work_queue()), queue(0)
+Pool<Sender> Sender::pool (SENDER_POOL_SIZE);
+
+/*=====================================================================
+
+  message_of
+
+  Get the message to send for a Publication. A Publication only holds
+  the encoded message, because a proton::message can't be shared 
+  between threads, so each connection's thread decodes its own. The
+  last message decoded on each thread is kept, so a message that goes
+  to several subscribers on one connection is decoded once. Keeping 
+  the Publication stops another one being allocated at its address.
+
+=====================================================================*/
+static const proton::message& message_of (const PublicationPtr& p)
+  {
+  static thread_local PublicationPtr last;
+  static thread_local proton::message m;
+  if (last != p)
+    {
+    m.decode (p->encoded);
+    last = p;
+    }
+  return m;
+  }
+
+SenderRef::SenderRef (Sender* s) : 
+        sender (s), generation (s->get_generation())
+  {
+  }
+
+Sender::Sender() :
+        senders(0), work_queue(0), queue(0),
+        unbuffered(0), dropped(0), conflated(0), closing(false), 
+        selector(0), replay(false), replay_from(0), batch_size(0),
+        batch_ms(0), flush_scheduled(false), batch_epoch(0), 
+        batch_started(0), spool_next(0)
+  {
+  }
+
+Sender::~Sender()
+  {
+  delete selector;
+  }
+
+Sender* Sender::acquire (proton::sender s, SenderList& ss)
+  {
+  Sender* sender = pool.acquire();
+  sender->sender = s;
+  sender->senders = &ss;
+  sender->work_queue = &s.work_queue();
+  return sender;
+  }
+
+void Sender::disconnect()
+  {
+  // Everything here belongs to the connection's thread. The buffers 
+  //   keep their capacity for the next user.
+  sender = proton::sender();
+  filters = proton::source::filter_map();
+  outbound.clear();
+  unbuffered = 0;
+  pending.clear();
+  batch.clear();
+  flush_scheduled = false;
+  spool_next = 0;
+  // Any messages still scheduled for this Sender are discarded
+  closing = true;
+  }
+
+void Sender::release()
+  {
+  // Put the rest back as the constructor left it
+  senders = 0;
+  work_queue = 0;
+  queue_name.clear();
+  queue = 0;
+  dropped = 0;
+  conflated = 0;
+  closing = false;
+  delete selector;
+  selector = 0;
+  replay = false;
+  replay_from = 0;
+  batch_size = 0;
+  batch_ms = 0;
+  pool.release (this);
+  }
+
+void Sender::set_selector (Selector* s, const proton::source::filter_map& f)
+  {
+  delete selector;
+  selector = s;
+  filters = f;
+  }
+
+void Sender::set_batching (size_t size, int us)
+  {
+  batch_size = size;
+  // Proton's timers count milliseconds
+  batch_ms = (us + 999) / 1000;
+  batch.reserve (size);
+  }
+
+void Sender::sendMsg (PublicationPtr p) 
+  {
+  if (closing) return;
+  Stats::count (Stats::DELIVERIES);
+  if (batch_size > 0)
+    {
+    if (batch.empty()) batch_started = Stats::now();
+    batch.push_back (p);
+    if (batch.size() >= batch_size)
+      flush();
+    else if (!flush_scheduled)
+      {
+      flush_scheduled = true;
+      schedule_flush (batch_ms);
+      }
+    return;
+    }
+  deliver (p);
+  }
+
+void Sender::deliver (PublicationPtr p) 
+  {
+  // Only send directly if nothing is waiting -- otherwise the client
+  //   would get messages out of order.
+  if (outbound.empty() && sender.credit() > 0)
+    {
+    DDBG (log << "Sender object " << this 
+       << " sending message to client";);
+    sender.send (message_of (p));
+    Stats::count (Stats::SENT);
+    Stats::record (Stats::SEND_LATENCY, Stats::now() - p->published);
+    return;
+    }
+  DDBG (log << "Sender object " << this 
+     << " has no credit -- buffering message";);
+  buffer (p);
+  }
+
+/*=====================================================================
+
+  flush
+
+  A batch is a message whose body is a list, with an entry for each
+  message in the batch. Each entry is itself a list:
+
+  [to (string), message ID (ulong), body, properties (map)]
+
+  The batch's own ID is the ID of the last message in it, so a client
+  that reconnects resumes from one more than that, as usual.
+
+=====================================================================*/
+void Sender::flush()
   {
+  if (batch.empty()) return;
+  proton::message m;
+  proton::codec::encoder e (m.body());
+  e << proton::codec::start::list();
+  for (size_t i = 0; i < batch.size(); i++)
+    {
+    const proton::message& s = message_of (batch[i]);
+    e << proton::codec::start::list() << batch[i]->to << batch[i]->seq 
+      << s.body() << s.properties() << proton::codec::finish();
+    }
+  e << proton::codec::finish();
+  m.to (queue_name);
+  m.properties().put (BATCH_PROPERTY, (uint64_t)batch.size());
+  m.id (proton::message_id (batch.back()->seq));
+  // The envelope is only sent by this Sender, but it might have to be
+  //   buffered, so it is a Publication like any other
+  Publication* env = new Publication();
+  env->set_message (m);
+  env->seq = batch.back()->seq;
+  env->published = batch.front()->published;
+  Stats::count (Stats::BATCHES);
+  batch.clear();
+  batch_epoch++;
+  deliver (PublicationPtr (env));
   }
 
-void Sender::sendMsg (proton::message m) 
+void Sender::schedule_flush (int ms)
   {
-  DDBG (std::cout << "Sender object " << this 
-     << " sending message to client" << std::endl;);
-  sender.send(m);
+  Stats::count (Stats::SENDER_WORK_ADDED);
+  work_queue->schedule (proton::duration (ms), 
+    proton::make_work (&Sender::flush_timer, this, get_generation(), 
+      batch_epoch));
+  }
+
+void Sender::flush_timer (uint32_t generation, uint32_t epoch)
+  {
+  Stats::count (Stats::SENDER_WORK_DONE);
+  if (get_generation() != generation) return;
+  if (epoch != batch_epoch && !batch.empty() && !closing)
+    {
+    // The batch this timer was set for filled up, and was sent. The
+    //   current one has only waited since its first message arrived.
+    int waited = (int)((Stats::now() - batch_started) / 1000000);
+    schedule_flush (waited < batch_ms ? batch_ms - waited : 0);
+    return;
+    }
+  flush_scheduled = false;
+  if (!closing) flush();
+  }
+
+void Sender::buffer (PublicationPtr p)
+  {
+  if (policy.conflate)
+    {
+    std::unordered_map<std::string, uint64_t>::iterator i = 
+      pending.find (p->key);
+    if (i != pending.end())
+      {
+      outbound[i->second - unbuffered] = p;
+      conflated++;
+      return;
+      }
+    }
+  if (outbound.full() && !overflow()) return;
+  Stats::count (Stats::BUFFERED);
+  if (policy.conflate) pending[p->key] = unbuffered + outbound.size();
+  outbound.push_back (p);
+  }
+
+void Sender::unbuffer()
+  {
+  if (policy.conflate)
+    {
+    std::unordered_map<std::string, uint64_t>::iterator i = 
+      pending.find (outbound.front()->key);
+    if (i != pending.end() && i->second == unbuffered) pending.erase (i);
+    }
+  outbound.pop_front();
+  unbuffered++;
+  }
+
+void Sender::sendBatch (SenderBatchPtr batch, PublicationPtr p)
+  {
+  Stats::count (Stats::SENDER_WORK_DONE);
+  for (SenderBatch::const_iterator i = batch->begin(); 
+        i != batch->end(); i++)
+    if (i->sender->get_generation() == i->generation) 
+      i->sender->sendMsg (p);
+  }
+
+void Sender::sendList (uint32_t generation, PublicationListPtr list)
+  {
+  Stats::count (Stats::SENDER_WORK_DONE);
+  if (get_generation() != generation) return;
+  for (PublicationList::const_iterator i = list->begin(); 
+        i != list->end(); i++)
+    sendMsg (*i);
+  }
+
+void Sender::sendSpooled (uint32_t generation, PublicationListPtr list,
+       uint64_t next)
+  {
+  if (get_generation() != generation) return;
+  sendList (generation, list);
+  spool_next = next;
+  request_spooled();
+  }
+
+void Sender::request_spooled()
+  {
+  if (spool_next == 0 || closing || outbound.size() > outbound.capacity() / 2)
+    return;
+  queue->add_work (proton::make_work (&Queue::catch_up, queue, 
+    SenderRef (this), spool_next));
+  spool_next = 0;
+  }
+
+bool Sender::overflow()
+  {
+  dropped++;
+  Stats::count (Stats::DROPPED);
+  if (queue) queue->add_dropped (1);
+  switch (policy.slow_consumer)
+    {
+    case SLOW_DROP_OLDEST:
+      unbuffer();
+      return true;
+    case SLOW_DROP_NEWEST:
+      return false;
+    case SLOW_DISCONNECT:
+      DWARN (log << "Closing link to slow consumer on queue " 
+         << queue_name;)
+      if (queue) queue->add_dropped (outbound.size());
+      Stats::count (Stats::DROPPED, outbound.size());
+      dropped += outbound.size();
+      unbuffered += outbound.size();
+      outbound.clear();
+      pending.clear();
+      closing = true;
+      sender.close (proton::error_condition ("amqp:resource-limit-exceeded",
+         "consumer is not keeping up with queue " + queue_name));
+      return false;
+    }
+  return false;
+  }
+
+void Sender::on_sendable (proton::sender &sender) 
+  {
+  while (!outbound.empty() && sender.credit() > 0)
+    {
+    sender.send (message_of (outbound.front()));
+    Stats::count (Stats::SENT);
+    Stats::record (Stats::SEND_LATENCY, 
+      Stats::now() - outbound.front()->published);
+    unbuffer();
+    }
+  request_spooled();
   }
 
 void Sender::unsubscribed() 
   {
-  DDBG (std::cout << "Deleting sender object " << this << std::endl;);
-  delete this;
+  Stats::count (Stats::SENDER_WORK_DONE);
+  if (dropped > 0)
+    DINFO (log << "Subscriber to queue " << queue_name << " dropped "
+       << dropped << " message(s)";)
+  if (conflated > 0)
+    DINFO (log << "Subscriber to queue " << queue_name 
+       << " skipped " << conflated << " conflated message(s)";)
+  DDBG (log << "Releasing sender object " << this;);
+  // Nothing can refer to the Queue after this
+  Queue* q = queue;
+  release();
+  q->remove_user();
   }
 
 void Sender::on_sender_close (proton::sender &sender) 
   {
-  DDBG (std::cout << "Sender object " << this << " closing" <<  std::endl;);
+  DDBG (log << "Sender object " << this << " closing";);
+  // If the ConnectionHandler has already unsubscribed this Sender,
+  //   because the session closed, it's not in the list.
+  SenderList::iterator i = senders->find (sender);
+  if (i == senders->end()) return;
+  disconnect();
   if (queue) 
     {
-    DDBG (std::cout << "Unsubscribing Sender object " << this << 
-       "from Queue object " << queue << std::endl;);
+    DDBG (log << "Unsubscribing Sender object " << this << 
+       "from Queue object " << queue;);
     queue->add_work (make_work (&Queue::unsubscribe, queue, this));
     } 
   // Remove this Sender from the list of Senders held by the 
   //   ConnectionManager
-  senders.erase (sender);
+  senders->erase (i);
+  if (!queue) release();
   }
 
-void Sender::bind_to_queue (Queue* q, std::string qn) 
+void Sender::bind_to_queue (Queue* q, const std::string& qn) 
   {
-  DDBG (std::cout << "Sender object " << this << " bound to Queue object " 
-     << q <<" (name " << qn << ")" << std::endl;);
+  DDBG (log << "Sender object " << this << " bound to Queue object " 
+     << q <<" (name " << qn << ")";);
   queue = q;
   queue_name = qn;
+  policy = q->get_policy();
+  if (outbound.capacity() != policy.buffer_size)
+    outbound.reset (policy.buffer_size);
+  // A buffered batch holds many keys, so it can't be conflated
+  if (batch_size > 0) policy.conflate = false;
 
   q->add_work (make_work (&Queue::subscribe, q, this));
+  proton::source_options so;
+  so.address (queue_name);
+  if (selector) so.filters (filters);
   sender.open (proton::sender_options()
-        .source ((proton::source_options().address (queue_name)))
+        .source (so)
         .handler(*this));
   }
 
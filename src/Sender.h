@@ -24,41 +24,234 @@
 #include <proton/work_queue.hpp>
 
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include "Pool.h"
+#include "Publication.h"
+#include "QueuePolicy.h"
+#include "RingBuffer.h"
+#include "Selector.h"
 #include "SenderList.h"
+#include "Stats.h"
 
 class Sender;
 class Queue;
 class ConnectionHandler;
 
+/** A SenderRef refers to a Sender from another thread, or from a work
+    item that might run after the Sender has been released. It is 
+    only valid while the Sender's generation is unchanged. */
+class SenderRef
+  {
+  public:
+  Sender* sender;
+  uint32_t generation;
+  SenderRef (Sender* s);
+  bool operator== (const Sender* s) const { return sender == s; }
+  };
+
+/** A SenderBatch is a list of Senders that share a connection, and
+    therefore a work queue. A Queue delivers a message to all of them
+    with a single work item. Batches are never modified once they
+    have been handed to a work queue -- the Queue replaces the whole
+    batch when its subscriptions change. */
+typedef std::vector<SenderRef> SenderBatch;
+typedef std::shared_ptr<const SenderBatch> SenderBatchPtr;
+
 /**
- Class Sender
+ Class Sender. Senders are pooled: use acquire() and release(), 
+ not new and delete.
  */
-class Sender : public proton::messaging_handler 
+class Sender : public proton::messaging_handler, public Pooled
   {
   //friend class ConnectionHandler;
+  friend class Pool<Sender>;
+
+  /** Released Senders, waiting to be reused. */
+  static Pool<Sender> pool;
 
   /** A reference to the underlying proton::sender object encapsulated
       by this object. */
   proton::sender sender;
 
-  /** A reference to the list of senders, maintained by the 
-      ConnectionManager. */
-  SenderList& senders;
+  /** The list of senders, maintained by the ConnectionManager. */
+  SenderList* senders;
 
   /** My private work queue. */
-  proton::work_queue& work_queue;
+  proton::work_queue* work_queue;
 
   std::string queue_name;
 
   /* The Queue to which this Sender is attached. */
   Queue* queue;
 
+  /** The delivery policy, copied from the Queue when this Sender is
+      bound to it. */
+  QueuePolicy policy;
+
+  /** Messages waiting for the client to grant link credit. The 
+      capacity is set from the queue's policy, and it never grows. */
+  RingBuffer<PublicationPtr> outbound;
+
+  /** Count of messages taken from the front of the outbound buffer,
+      since the Sender was bound. A message's position in the buffer
+      is the count when it was added, less the count now. */
+  uint64_t unbuffered;
+
+  /** On a conflating queue, the position of the buffered message 
+      with each conflation key, counted as for unbuffered. */
+  std::unordered_map<std::string, uint64_t> pending;
+
+  /** Count of messages discarded because the outbound buffer was
+      full. */
+  unsigned long dropped;
+
+  /** Count of buffered messages replaced by newer ones with the same
+      conflation key. */
+  unsigned long conflated;
+
+  /** Set when we have closed the link because the client could not
+      keep up. Further messages are discarded. */
+  bool closing;
+
+  /** The message selector supplied by the client, or null if the
+      client wants every message. This Sender owns it. */
+  Selector* selector;
+
+  /** The filters supplied by the client. We send them back when we
+      open the link, to show the client that they are in force. */
+  proton::source::filter_map filters;
+
+  /** Set if the client asked to resume from a sequence number. */
+  bool replay;
+
+  /** The sequence number to resume from, if replay is set: the first
+      one the client has not seen, not the last one it has. */
+  uint64_t replay_from;
+
+  /** If this is not zero, the client asked for messages in batches 
+      of up to this many, each sent as one message with a list body. */
+  size_t batch_size;
+
+  /** The longest a message waits for its batch to fill, in msec. */
+  int batch_ms;
+
+  /** Messages waiting to go out in the next batch. */
+  PublicationList batch;
+
+  /** Set while a flush_timer() is scheduled on the work queue. */
+  bool flush_scheduled;
+
+  /** Counts the batches sent. A timer that was set for an earlier 
+      batch, which was sent because it filled up, must not cut the 
+      current one short. */
+  uint32_t batch_epoch;
+
+  /** When the first message was added to the current batch, in 
+      nanoseconds on the monotonic clock. */
+  uint64_t batch_started;
+
+  /** While this Sender is catching up from the queue's spool, and is
+      waiting for room in its buffer before asking for more, the 
+      position in the spool to ask for next. Otherwise zero. */
+  uint64_t spool_next;
+
+  /** Ask the Queue for the next messages from its spool, if the 
+      outbound buffer is no more than half full. Otherwise, wait for
+      on_sendable() to empty it. */
+  void request_spooled();
+
   void on_sender_close (proton::sender &sender) override;
 
+  /** Called by Proton when the client grants more credit. Send as
+      many buffered messages as the credit allows. */
+  void on_sendable (proton::sender &sender) override;
+
+  /** Apply the queue's slow-consumer policy, when a message arrives
+      and the outbound buffer is full. Returns true if the new 
+      message should still be buffered. */
+  bool overflow();
+
+  /** Add a message to the outbound buffer, or, if the queue conflates
+      and a message with the same key is waiting, replace that. */
+  void buffer (PublicationPtr p);
+
+  /** Remove the oldest message from the outbound buffer. */
+  void unbuffer();
+
+  /** Send a message to the client, if it has credit and nothing is
+      waiting, or buffer it. */
+  void deliver (PublicationPtr p);
+
+  /** Send the messages waiting in the batch as one message. */
+  void flush();
+
+  /** Schedule flush_timer() for the current batch, in ms msec. */
+  void schedule_flush (int ms);
+
+  /** Called on the work queue when a batch has waited long enough,
+      unless this Sender has been released since, for the given 
+      generation. If the batch for the given epoch has already been 
+      sent, the timer is set again, for the rest of the current 
+      batch's time. */
+  void flush_timer (uint32_t generation, uint32_t epoch);
+
+  Sender();
+
+  ~Sender();
+
   public:
 
-  Sender (proton::sender s, SenderList& ss);
+  /** Get a Sender for a new link, from the pool. */
+  static Sender* acquire (proton::sender s, SenderList& ss);
+
+  /** Drop the link, and anything waiting to be sent on it, when the
+      link, its session, or its connection closes. This must be 
+      called on the connection's thread, before the Sender is 
+      released. Messages that arrive afterwards are discarded. */
+  void disconnect();
+
+  /** Return this Sender to the pool, once it has been disconnected, 
+      and nothing links to it any more. This can be called on any
+      thread, but only by the last user. Nothing must use this object 
+      afterwards, except through a SenderRef, which will show that it
+      is no longer valid. */
+  void release();
+
+  /** Get the pool, for its statistics. */
+  static const Pool<Sender>& get_pool() { return pool; }
+
+  /** Set the message selector, and the filters it came from. This 
+      Sender takes ownership of the selector. This must be called 
+      before the Sender is bound to a queue, because the selector is
+      read by the Queue, on its own thread. */
+  void set_selector (Selector* s, const proton::source::filter_map& f);
+
+  /** Get the message selector, or null if there isn't one. */
+  const Selector* get_selector() const { return selector; }
+
+  /** Ask for the messages from sequence number from onwards, that 
+      the queue still holds, to be sent when this Sender subscribes.
+      from is the first message the client has not seen, so it is 
+      sent too.
+      Like the selector, this must be set before the Sender is bound
+      to a queue. */
+  void set_replay_from (uint64_t from) { replay = true; replay_from = from; }
+
+  /** Get the sequence number to resume from. Returns false if the
+      client did not ask to resume. */
+  bool get_replay_from (uint64_t& from) const 
+    { 
+    from = replay_from; 
+    return replay; 
+    }
+
+  /** Ask for messages to be sent in batches of up to size, each 
+      waiting no more than the given number of microseconds. This 
+      must be set before the Sender is bound to a queue. */
+  void set_batching (size_t size, int us);
 
   /** get_queue() is called by ConnectionManager, to determine the
       Queue assigned to a specific Sender. */
@@ -67,20 +260,47 @@ class Sender : public proton::messaging_handler
   /** Add a method call to my private work queue. */
   bool add_work (proton::work f) 
     {
-    return work_queue.add(f);
+    Stats::count (Stats::SENDER_WORK_ADDED);
+    return work_queue->add(f);
     }
 
-  /** Send a specific message immediately, to all subscribers on this 
-      Queue. */
-  void sendMsg (proton::message m);
+  /** Get the work queue of this Sender's connection. All the Senders
+      on the same connection share it. */
+  proton::work_queue& get_work_queue() { return *work_queue; }
+
+  /** Send a message to every Sender in a batch. This must be run on
+      the batch's work queue -- all the Senders in a batch share one. 
+      Senders that have been released since the batch was made are
+      skipped. */
+  static void sendBatch (SenderBatchPtr batch, PublicationPtr p);
+
+  /** Send a specific message to the client. If the client has not
+      granted any credit, the message is buffered until it does. If the
+      buffer is full, the Queue's slow-consumer policy decides what 
+      happens. The Publication is shared with other Senders, so it
+      is never copied. */
+  void sendMsg (PublicationPtr p);
+
+  /** Send a list of messages to the client, in order, as sendMsg()
+      does, unless this Sender has been released since the list was
+      made, for the given generation. */
+  void sendList (uint32_t generation, PublicationListPtr list);
+
+  /** Send a list of messages read from the Queue's spool, as 
+      sendList() does, then ask the Queue for more, from position 
+      next in the spool, when there is room for them. */
+  void sendSpooled (uint32_t generation, PublicationListPtr list, 
+      uint64_t next);
 
-  /** Called by the Queue which a client unsubscribed. This object can
-      delete itself at this point. */
+  /** Called by the Queue which a client unsubscribed. This object
+      releases itself at this point, and stops using the Queue. */
   void unsubscribed();
 
-  /** Called by the QueueManager when a client subscribes to a Queue. 
-      This instance registers itself with Proton as the handler for 
-      sender events. */
-  void bind_to_queue (Queue* q, std::string qn);
+  /** Called by the ConnectionHandler when a client subscribes to a 
+      Queue. This instance registers itself with Proton as the handler
+      for sender events. The caller has added a user to the Queue for
+      this Sender, which is removed when the Sender is finished with
+      it. */
+  void bind_to_queue (Queue* q, const std::string& qn);
   };
 
@@ -21,6 +21,12 @@
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
 #include <ostream>
 #include <sstream>
 #include <iostream>
@@ -31,24 +37,124 @@
 #include "Server.h"
 #include "QueueManager.h"
 #include "ConnectionHandler.h"
+#include "config.h"
 #include "logging.h" 
 
-Server::Server (const std::string addr) :
-        container (NAME), queue_manager (container), 
-        listen_handler (queue_manager)
- {
- DDBG (std::cout << "Starting listener" << std::endl;)
- container.listen (addr, listen_handler);
- }
+Server::Server (const std::string addr, int n)
+  {
+  if (n < 1) n = 1;
+  size_t colon = addr.rfind (':');
+  std::string host = addr.substr (0, colon);
+  int port = atoi (addr.c_str() + colon + 1);
+  std::vector<QueueManager*> managers;
+  for (int i = 0; i < n; i++)
+    {
+    Shard* s = new Shard (n == 1 ? NAME : NAME "-" + std::to_string (i));
+    shards.push_back (s);
+    managers.push_back (&s->queue_manager);
+    }
+  set_spool_dir (DEFAULT_SPOOL_DIR);
+  for (int i = 0; i < n; i++)
+    {
+    shards[i]->queue_manager.set_shards (managers);
+    // Every Shard gets every message, so only the first needs to write
+    //   to shared memory
+    if (i > 0) shards[i]->queue_manager.set_shm_dir ("");
+    std::string a = n == 1 ? addr : host + ":" + std::to_string (port + i);
+    DDBG (log << "Starting listener on " << a;)
+    shards[i]->container.listen (a, shards[i]->listen_handler);
+    }
+  }
+
+Server::~Server()
+  {
+  for (size_t i = 0; i < shards.size(); i++)
+    delete shards[i];
+  }
+
+/* Any Shard's QueueManager publishes to all of them. */
 
 void Server::publish (const std::string &name, const std::string &text)
   {
-  queue_manager.publish (name, text);
+  shards[0]->queue_manager.publish (name, text);
+  }
+
+void Server::publish (const std::string &name, const std::string &text,
+       const proton::message::property_map &properties)
+  {
+  shards[0]->queue_manager.publish (name, text, properties);
+  }
+
+void Server::publish (const Metric &m)
+  {
+  shards[0]->queue_manager.publish (m);
+  }
+
+void Server::set_queue_policy (const std::string &name, 
+       const QueuePolicy& p)
+  {
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->queue_manager.set_policy (name, p);
+  }
+
+void Server::set_spool_dir (const std::string &dir)
+  {
+  // Every Shard spools the same messages, with the same IDs, but a 
+  //   spool can only have one writer
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->queue_manager.set_spool_dir (shards.size() == 1 ? dir 
+      : dir + "/" + shards[i]->container.id());
+  }
+
+void Server::set_max_queues (size_t n)
+  {
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->queue_manager.set_max_queues (n);
+  }
+
+/*=====================================================================
+
+  run_pinned
+
+  Pin the calling thread to a core, and run a Shard's container on 
+  it. If the thread can't be pinned, it runs anyway.
+
+=====================================================================*/
+static void run_pinned (Shard* s, int core)
+  {
+  cpu_set_t cpus;
+  CPU_ZERO (&cpus);
+  CPU_SET (core, &cpus);
+  int err = pthread_setaffinity_np (pthread_self(), sizeof (cpus), &cpus);
+  if (err != 0)
+    DWARN (log << "Can't pin thread to core " << core << ": " 
+       << strerror (err);)
+  s->container.run();
   }
 
 void Server::run() 
   {
-  DDBG (std::cout << "Running container" << std::endl;)
-  container.run (std::thread::hardware_concurrency());
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->queue_manager.start();
+  int cores = std::thread::hardware_concurrency();
+  if (cores < 1) cores = 1;
+  if (shards.size() == 1)
+    {
+    DDBG (log << "Running container";)
+    shards[0]->container.run (cores);
+    return;
+    }
+
+  // Each core runs one thread, for Shard (core % shards). If there are 
+  //   more Shards than cores, some cores run more than one.
+  int n = std::max (cores, (int)shards.size());
+  DINFO (log << "Running " << shards.size() << " shards on " << n 
+     << " threads";)
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n; i++)
+    threads.push_back (std::thread (run_pinned, shards[i % shards.size()], 
+      i % cores));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
   }
 
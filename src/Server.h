@@ -23,42 +23,93 @@
 #include <proton/transport.hpp>
 #include <proton/work_queue.hpp>
 
+#include <vector>
+
 #include "QueueManager.h"
 #include "ConnectionHandler.h"
 #include "ListenHandler.h"
 
+/** A Shard is a proton::container, with its own listener, and its own
+    QueueManager, so its own Queues and subscriptions. Nothing in one 
+    Shard refers to anything in another, except that a message 
+    published to any Shard's QueueManager is published on all of 
+    them. */
+class Shard
+  {
+  public:
+  proton::container container;
+  QueueManager queue_manager;
+  ListenHandler listen_handler;
+
+  Shard (const std::string& id) : container (id), 
+      queue_manager (container), listen_handler (queue_manager)
+    {
+    }
+  };
+
 /** Server is the main class for this application. Its run() 
     method defines the program's lifetime. An instance of
-    Server encapsulates a proton::container, from which all
-    subsequent Proton entities are created. */
+    Server encapsulates one or more Shards, each with a 
+    proton::container, from which all subsequent Proton entities
+    are created. 
+
+    With one Shard, Proton runs the container on one thread for each
+    core, and any thread can handle any connection. With more, each 
+    Shard listens on its own port -- the first on the port given, 
+    the next on the port after that, and so on -- and runs on its own
+    threads, each pinned to a core, so that a Shard's Queues and 
+    connections stay in the same cores' caches. A message is 
+    published once to each Shard, and each Shard fans it out to its 
+    own subscribers. */
 class Server 
   {
   public:
 
   /** Create a Server, specifying the listen address
-      (which could be 0.0.0.0 or a real IP). The constructor
-      sets up the QueueManeger and main listener. */
-  Server (const std::string addr);
+      (which could be 0.0.0.0 or a real IP) and port, like
+      "0.0.0.0:5672", and the number of Shards. The constructor
+      sets up the Shards, each with its QueueManager and 
+      listener. */
+  Server (const std::string addr, int shards = 1);
+
+  ~Server();
 
   /** Publish the specified text message to the queue with the specified
-      name. The queue will be created if it doesn't exist but, in that
-      case, no message will be sent -- if there were subscribers, the
-      queue would exist already. */
+      name. The queue will be created if it doesn't exist, and keeps
+      the message for clients that subscribe later, according to its
+      policy. */
   void publish (const std::string &name, const std::string &text);
 
+  /** Publish a text message with application properties. Clients can
+      filter messages on their properties, using message selectors. */
+  void publish (const std::string &name, const std::string &text,
+      const proton::message::property_map &properties);
+
+  /** Publish a Metric, as a structured message. See Metric.h. */
+  void publish (const Metric &m);
+
+  /** Set the delivery policy for the named queue, or for all queues
+      if the name is "*". This must be called before run(). */
+  void set_queue_policy (const std::string &name, const QueuePolicy& p);
+
+  /** Set the directory for queue spools. With more than one Shard,
+      each has a subdirectory, named after its container. This must
+      be called before set_queue_policy(). */
+  void set_spool_dir (const std::string &dir);
+
+  /** Set the most queues each Shard can have. This must be called 
+      before run(). */
+  void set_max_queues (size_t n);
+
   /** Run this server. In practice, this method does not
       exit, except in a catastrophic failure. */
   void run();
 
   private:
 
-  /** This instance of Server will own the main proton::container. */
-  proton::container container;
- 
-  // The main QueueManager and ListenHandler are owned by this
-  //   object, and have the same lifetime.
-  QueueManager queue_manager;
-  ListenHandler listen_handler;
+  /** The Shards, which this object owns. There is always at least 
+      one. */
+  std::vector<Shard*> shards;
   };
 
 
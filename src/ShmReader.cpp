@@ -0,0 +1,167 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ShmReader.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "ShmReader.h"
+
+static int64_t wall_ms()
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+ShmReader::ShmReader (const std::string &path, ShmHeader *header,
+        size_t size, bool writable) :
+        path (path), header (header), size (size),
+        mask (header->slots - 1), writable (writable),
+        position (header->head.load (std::memory_order_acquire))
+  {
+  }
+
+ShmReader::~ShmReader()
+  {
+  munmap (header, size);
+  }
+
+/*=====================================================================
+
+  ShmReader::open
+
+=====================================================================*/
+ShmReader *ShmReader::open (const std::string &path, std::string &error)
+  {
+  // A reader that can't write the file can still read it, but it
+  //   can't tell the writer it is waiting
+  bool writable = true;
+  int fd = ::open (path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0 && errno == EACCES)
+    {
+    writable = false;
+    fd = ::open (path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+  if (fd < 0)
+    {
+    error = path + ": " + strerror (errno);
+    return 0;
+    }
+  struct stat sb;
+  void *m = MAP_FAILED;
+  if (fstat (fd, &sb) == 0 && (size_t)sb.st_size >= shm_header_size())
+    m = mmap (0, sb.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+      MAP_SHARED, fd, 0);
+  close (fd);
+  if (m == MAP_FAILED)
+    {
+    error = path + ": not a ring";
+    return 0;
+    }
+  ShmHeader *h = (ShmHeader *)m;
+  if (h->magic != SHM_MAGIC || h->version != SHM_VERSION
+        || (size_t)sb.st_size < shm_header_size()
+             + (size_t)h->slots * h->slot_size)
+    {
+    error = path + ": not a ring";
+    munmap (m, sb.st_size);
+    return 0;
+    }
+  return new ShmReader (path, h, sb.st_size, writable);
+  }
+
+/*=====================================================================
+
+  ShmReader::read
+
+=====================================================================*/
+ShmReader::Result ShmReader::read (ShmRecord &r, uint64_t &lost)
+  {
+  uint64_t head = header->head.load (std::memory_order_acquire);
+  if (position >= head)
+    return header->closed.load() ? CLOSED : EMPTY;
+
+  uint64_t want = 2 * position + 2;
+  const ShmSlot *s = shm_slot (header, position);
+  uint64_t v = s->version.load (std::memory_order_acquire);
+  if (v == want)
+    {
+    r.seq = s->seq;
+    r.time = s->time;
+    r.has_value = s->flags & SHM_HAS_VALUE;
+    r.value = s->value;
+    r.truncated = s->flags & SHM_TRUNCATED;
+    // The lengths can be nonsense if the slot is being overwritten,
+    //   but then the version check below fails
+    size_t room = header->slot_size - sizeof (ShmSlot);
+    size_t nl = std::min ((size_t)s->name_length, room);
+    size_t tl = std::min ((size_t)s->text_length, room - nl);
+    const char *data = (const char *)(s + 1);
+    r.queue.assign (data, nl);
+    r.text.assign (data + nl, tl);
+    std::atomic_thread_fence (std::memory_order_acquire);
+    if (s->version.load (std::memory_order_relaxed) == want)
+      {
+      position++;
+      return READ;
+      }
+    }
+  else if (v < want)
+    return EMPTY;
+
+  // The writer has been round the ring since this message was written.
+  //   Skip to the oldest one it can't have overwritten yet.
+  head = header->head.load (std::memory_order_acquire);
+  uint64_t oldest = head > mask + 1 ? head - (mask + 1) : 0;
+  oldest = std::max (oldest, position + 1);
+  lost = oldest - position;
+  position = oldest;
+  return LAPPED;
+  }
+
+/*=====================================================================
+
+  ShmReader::wait
+
+=====================================================================*/
+bool ShmReader::wait (int timeout_ms)
+  {
+  uint32_t seen = (uint32_t)position;
+  if (header->notify.load() != seen || header->closed.load()) return false;
+  struct timespec ts;
+  if (!writable)
+    {
+    // Poll, since the writer won't wake us
+    int64_t end = wall_ms() + timeout_ms;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 100000;
+    while (header->notify.load() == seen && !header->closed.load()
+          && wall_ms() < end)
+      nanosleep (&ts, 0);
+    return true;
+    }
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  header->waiters++;
+  if (header->notify.load() == seen)
+    syscall (SYS_futex, &header->notify, FUTEX_WAIT, seen, &ts, 0, 0);
+  header->waiters--;
+  return true;
+  }
+
@@ -0,0 +1,170 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ShmReader.h
+
+  The layout of a shared memory ring, and ShmReader, which reads one.
+  See ShmRing.h for how the server writes a ring.
+
+  The ring is a file in /dev/shm. It starts with a ShmHeader, followed
+  by the slots, each slot_size bytes. A slot is a ShmSlot, followed by
+  the queue name the message was published to, and the message text.
+  Text that doesn't fit is truncated, and the slot is flagged. A 
+  Metric's text is its value. Metrics, and messages with a numeric 
+  "value" property, also have their value in the slot, so a reader 
+  that wants numbers doesn't have to parse anything.
+
+  Each slot is protected by a seqlock. To write message n (counting 
+  from zero), the writer sets the slot's version to 2n+1, fills in the
+  slot, then sets the version to 2n+2. A reader wanting message n 
+  copies the slot, and checks that the version was 2n+2 both before
+  and after. A smaller version means the message has not been written
+  yet; a larger one, that the reader has been lapped.
+
+  A reader that has caught up can poll head, or wait on the notify
+  word with FUTEX_WAIT. The writer only makes the FUTEX_WAKE system
+  call when waiters is not zero. When the server stops, or restarts,
+  it sets closed in the old file and unlinks it, so readers should
+  then open the file again.
+
+  This file, and ShmReader.cpp, use nothing but the C++ standard 
+  library and Linux system calls, so that local clients can build 
+  them into their own programs.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#define SHM_MAGIC 0x52534d41 // "AMSR"
+#define SHM_VERSION 1
+
+/** Set in ShmSlot::flags if the text was too long for the slot. */
+#define SHM_TRUNCATED 1
+
+/** Set in ShmSlot::flags if the message has a value. */
+#define SHM_HAS_VALUE 2
+
+/** The start of the file. The fields the writer changes for every
+    message are on a cache line of their own. */
+struct ShmHeader
+  {
+  uint32_t magic;
+  uint32_t version;
+  /** The number of slots, which is a power of two. */
+  uint32_t slots;
+  /** The size of each slot, including its ShmSlot, in bytes. */
+  uint32_t slot_size;
+  alignas (64) std::atomic<uint64_t> head;
+  /** The low 32 bits of head, for futex waiters. */
+  std::atomic<uint32_t> notify;
+  /** The number of readers waiting on notify. */
+  std::atomic<uint32_t> waiters;
+  /** Set when the writer has finished with this file. */
+  std::atomic<uint32_t> closed;
+  };
+
+/** The fixed part of a slot. */
+struct ShmSlot
+  {
+  std::atomic<uint64_t> version;
+  /** The message ID. */
+  uint64_t seq;
+  /** When the message was written, in msec since the epoch. */
+  int64_t time;
+  /** The message's "value" property, if SHM_HAS_VALUE is set. */
+  double value;
+  uint16_t name_length;
+  uint16_t flags;
+  uint32_t text_length;
+  };
+
+/** The size of the header, which is rounded up so that the slots 
+    start on a cache line. */
+inline size_t shm_header_size()
+  {
+  return (sizeof (ShmHeader) + 63) & ~(size_t)63;
+  }
+
+/** Get the slot that message n is written to. */
+inline ShmSlot *shm_slot (ShmHeader *h, uint64_t n)
+  {
+  return (ShmSlot *)((char *)h + shm_header_size() 
+    + (n & (h->slots - 1)) * h->slot_size);
+  }
+
+/** A message read by ShmReader. */
+class ShmRecord
+  {
+  public:
+  uint64_t seq;
+  int64_t time;
+  bool has_value;
+  double value;
+  bool truncated;
+  std::string queue;
+  std::string text;
+  };
+
+class ShmReader
+  {
+  private:
+
+  std::string path;
+
+  ShmHeader *header;
+  size_t size;
+  uint64_t mask;
+
+  /** Set if this process can write the file, and so can add itself
+      to the header's waiters. If not, wait() has to poll. */
+  bool writable;
+
+  /** The number of the next message to read. */
+  uint64_t position;
+
+  ShmReader (const std::string &path, ShmHeader *header, size_t size,
+      bool writable);
+
+  public:
+
+  enum Result
+    {
+    /** A message was read. */
+    READ,
+    /** There are no new messages. */
+    EMPTY,
+    /** The writer overwrote messages before they were read. The
+        reader skips to the oldest message still in the ring. */
+    LAPPED,
+    /** The writer has closed the file. Open it again. */
+    CLOSED
+    };
+
+  ~ShmReader();
+
+  /** Map the ring at path. The reader starts with the next message
+      written. Returns null, and sets error, if the file is missing,
+      or isn't a ring. */
+  static ShmReader *open (const std::string &path, std::string &error);
+
+  /** Read the next message into r. If LAPPED is returned, lost is
+      set to the number of messages skipped, and the next call reads
+      the oldest. */
+  Result read (ShmRecord &r, uint64_t &lost);
+
+  /** Wait for a new message, for up to timeout_ms msec. Returns
+      straight away if there is one already. Returns true if it 
+      slept in the kernel, or polled, rather than returning at 
+      once. */
+  bool wait (int timeout_ms);
+  };
+
@@ -0,0 +1,181 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ShmRing.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "ShmRing.h"
+#include "Stats.h"
+#include "config.h"
+#include "logging.h"
+
+static int64_t wall_ms()
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+/*=====================================================================
+
+  close_old
+
+  Mark a ring left by an earlier run as closed, so that its readers
+  know to open the new one. Anything that isn't a ring is left alone.
+
+=====================================================================*/
+static void close_old (const std::string &path)
+  {
+  int fd = ::open (path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) return;
+  struct stat sb;
+  if (fstat (fd, &sb) == 0 && (size_t)sb.st_size >= sizeof (ShmHeader))
+    {
+    void *m = mmap (0, sizeof (ShmHeader), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+    if (m != MAP_FAILED)
+      {
+      ShmHeader *h = (ShmHeader *)m;
+      if (h->magic == SHM_MAGIC)
+        {
+        h->closed.store (1);
+        syscall (SYS_futex, &h->notify, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+        }
+      munmap (m, sizeof (ShmHeader));
+      }
+    }
+  close (fd);
+  }
+
+ShmRing::ShmRing (const std::string &path, ShmHeader *header,
+        size_t size) :
+        path (path), header (header), size (size), next (0)
+  {
+  }
+
+ShmRing::~ShmRing()
+  {
+  header->closed.store (1);
+  syscall (SYS_futex, &header->notify, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+  munmap (header, size);
+  unlink (path.c_str());
+  }
+
+/*=====================================================================
+
+  open
+
+=====================================================================*/
+ShmRing *ShmRing::open (const std::string &path, size_t slots,
+     std::string &error)
+  {
+  size_t n = 2;
+  while (n < slots) n *= 2;
+  size_t size = shm_header_size() + n * SHM_SLOT_SIZE;
+
+  // Build the new ring under a temporary name, and rename it into
+  //   place, so that a reader never sees it half made.
+  std::string tmp = path + ".new";
+  unlink (tmp.c_str());
+  int fd = ::open (tmp.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+    0644);
+  if (fd < 0)
+    {
+    error = tmp + ": " + strerror (errno);
+    return 0;
+    }
+  // Allocate the memory now. If /dev/shm filled up later, writing to
+  //   the mapping would raise SIGBUS.
+  int err = posix_fallocate (fd, 0, size);
+  void *m = err == 0 ? mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    fd, 0) : MAP_FAILED;
+  if (err == 0 && m == MAP_FAILED) err = errno;
+  close (fd);
+  if (err != 0)
+    {
+    error = tmp + ": " + strerror (err);
+    unlink (tmp.c_str());
+    return 0;
+    }
+
+  // The file is all zeros, which is a valid ShmHeader, and valid
+  //   slots that have never been written
+  ShmHeader *h = (ShmHeader *)m;
+  h->version = SHM_VERSION;
+  h->slots = n;
+  h->slot_size = SHM_SLOT_SIZE;
+  h->magic = SHM_MAGIC;
+
+  close_old (path);
+  if (rename (tmp.c_str(), path.c_str()) != 0)
+    {
+    error = path + ": " + strerror (errno);
+    munmap (m, size);
+    unlink (tmp.c_str());
+    return 0;
+    }
+  DINFO (log << "Writing messages to shared memory ring " << path;)
+  return new ShmRing (path, h, size);
+  }
+
+/*=====================================================================
+
+  write
+
+=====================================================================*/
+void ShmRing::write (const Publication &p)
+  {
+  uint64_t n = next++;
+  ShmSlot *s = shm_slot (header, n);
+  s->version.store (2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+
+  s->seq = p.seq;
+  s->time = wall_ms();
+  s->flags = 0;
+  if (p.has_value)
+    {
+    s->value = p.value;
+    s->flags |= SHM_HAS_VALUE;
+    }
+
+  // The name and text are copied straight from the Publication
+  const std::string& name = p.to;
+  const std::string& text = p.text;
+  char *data = (char *)(s + 1);
+  size_t room = header->slot_size - sizeof (ShmSlot);
+  size_t nl = std::min (name.size(), std::min (room, (size_t)UINT16_MAX));
+  size_t tl = std::min (text.size(), room - nl);
+  if (nl < name.size() || tl < text.size()) s->flags |= SHM_TRUNCATED;
+  memcpy (data, name.data(), nl);
+  memcpy (data + nl, text.data(), tl);
+  s->name_length = nl;
+  s->text_length = tl;
+
+  s->version.store (2 * n + 2, std::memory_order_release);
+  header->head.store (n + 1, std::memory_order_release);
+  // Readers check notify after saying they are waiting, so one of us
+  //   will see the other's change
+  header->notify.store ((uint32_t)(n + 1));
+  if (header->waiters.load() > 0)
+    syscall (SYS_futex, &header->notify, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+  Stats::count (Stats::SHM_WRITTEN);
+  }
@@ -0,0 +1,64 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ShmRing.h
+
+  A ShmRing publishes the messages on one Queue to processes on the
+  same host, through a ring of fixed-size slots in a file in /dev/shm.
+  A local reader maps the file, and reads messages straight out of
+  memory: there is no connection, no AMQP encoding, and no system
+  call for each message.
+
+  There is one writer -- the Queue, on its own work queue -- and any
+  number of readers, which the writer does not know about. A slow
+  reader is lapped: the writer never waits. The layout of the file,
+  and the seqlock that protects each slot, are described in 
+  ShmReader.h, which local clients can use to read it.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "Publication.h"
+#include "ShmReader.h"
+
+class ShmRing
+  {
+  private:
+
+  std::string path;
+
+  /** The mapped file. */
+  ShmHeader *header;
+  size_t size;
+
+  /** The number of the next message. Only this object writes it,
+      so it's kept here, not read from the header. */
+  uint64_t next;
+
+  ShmRing (const std::string &path, ShmHeader *header, size_t size);
+
+  public:
+
+  ~ShmRing();
+
+  /** Create the ring at path, with at least the given number of
+      slots, replacing any file that is there already. Returns null,
+      and sets error, if the file can't be created. */
+  static ShmRing *open (const std::string &path, size_t slots,
+      std::string &error);
+
+  /** Write a message to the next slot, and wake any waiting
+      readers. */
+  void write (const Publication &p);
+  };
+
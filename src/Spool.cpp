@@ -0,0 +1,440 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Spool.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "Spool.h"
+#include "Stats.h"
+#include "config.h"
+#include "logging.h"
+
+/** The fixed part of a record. See Spool.h. */
+struct RecordHeader
+  {
+  uint32_t length;
+  uint32_t reserved;
+  uint64_t seq;
+  int64_t time;
+  };
+
+static size_t align8 (size_t n)
+  {
+  return (n + 7) & ~(size_t)7;
+  }
+
+static int64_t wall_ms()
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+/*=====================================================================
+
+  make_dirs
+
+  Create a directory, and any of its parents that don't exist.
+
+=====================================================================*/
+static bool make_dirs (const std::string &path, std::string &error)
+  {
+  for (size_t i = 1; i <= path.size(); i++)
+    {
+    if (i < path.size() && path[i] != '/') continue;
+    std::string p = path.substr (0, i);
+    if (mkdir (p.c_str(), 0755) != 0 && errno != EEXIST)
+      {
+      error = p + ": " + strerror (errno);
+      return false;
+      }
+    }
+  return true;
+  }
+
+Spool::Spool (const std::string &dir, const QueuePolicy &policy) :
+        dir (dir), max_bytes (policy.spool_size),
+        max_age ((int64_t)policy.spool_age * 1000), total (0),
+        max_seq (0), next_position (1), failing (false)
+  {
+  }
+
+Spool::~Spool()
+  {
+  for (size_t i = 0; i < segments.size(); i++)
+    {
+    munmap (segments[i]->base, segments[i]->size);
+    delete segments[i];
+    }
+  }
+
+std::string Spool::escape (const std::string &name)
+  {
+  std::string s;
+  for (size_t i = 0; i < name.size(); i++)
+    {
+    unsigned char c = name[i];
+    // A leading '.' would make names like ".." special
+    if (isalnum (c) || c == '-' || c == '_' || (c == '.' && i > 0))
+      s += c;
+    else
+      {
+      char x[4];
+      snprintf (x, sizeof (x), "%%%02X", c);
+      s += x;
+      }
+    }
+  return s;
+  }
+
+/*=====================================================================
+
+  open
+
+=====================================================================*/
+Spool *Spool::open (const std::string &dir, const QueuePolicy &policy,
+     std::string &error)
+  {
+  if (!make_dirs (dir, error)) return 0;
+  DIR *d = opendir (dir.c_str());
+  if (!d)
+    {
+    error = dir + ": " + strerror (errno);
+    return 0;
+    }
+  std::vector<std::string> names;
+  struct dirent *e;
+  while ((e = readdir (d)) != 0)
+    {
+    std::string n = e->d_name;
+    if (n.size() > 4 && n.compare (n.size() - 4, 4, ".seg") == 0)
+      names.push_back (n);
+    }
+  closedir (d);
+  // The names are zero-padded sequence numbers, so they sort in order
+  std::sort (names.begin(), names.end());
+
+  Spool *spool = new Spool (dir, policy);
+  for (size_t i = 0; i < names.size(); i++)
+    {
+    std::string path = dir + "/" + names[i];
+    std::string err;
+    Segment *s = map (path, strtoull (names[i].c_str(), 0, 10), false, err);
+    if (!s)
+      {
+      DWARN (log << "Can't open spool segment " << err;)
+      continue;
+      }
+    spool->recover (s);
+    if (s->records == 0)
+      {
+      munmap (s->base, s->size);
+      unlink (path.c_str());
+      delete s;
+      continue;
+      }
+    spool->place (s);
+    }
+  if (!spool->segments.empty())
+    DINFO (log << "Spool " << dir << " holds messages " << spool->first()
+       << " to " << spool->last();)
+  return spool;
+  }
+
+/*=====================================================================
+
+  map
+
+=====================================================================*/
+Spool::Segment *Spool::map (const std::string &path, uint64_t first_seq,
+     bool create, std::string &error)
+  {
+  int flags = O_RDWR | O_CLOEXEC;
+  if (create) flags |= O_CREAT | O_EXCL;
+  int fd = ::open (path.c_str(), flags, 0644);
+  if (fd < 0)
+    {
+    error = path + ": " + strerror (errno);
+    return 0;
+    }
+  size_t size;
+  if (create)
+    {
+    // Allocate the blocks now. If the disk filled up later, writing to
+    //   the mapping would raise SIGBUS, rather than returning an error.
+    int err = posix_fallocate (fd, 0, SPOOL_SEGMENT_SIZE);
+    if (err != 0)
+      {
+      error = path + ": " + strerror (err);
+      close (fd);
+      unlink (path.c_str());
+      return 0;
+      }
+    size = SPOOL_SEGMENT_SIZE;
+    }
+  else
+    {
+    struct stat sb;
+    if (fstat (fd, &sb) != 0)
+      {
+      error = path + ": " + strerror (errno);
+      close (fd);
+      return 0;
+      }
+    // A file of any other size was not written by this program, or
+    //   was cut short, so its records can't be trusted
+    if (sb.st_size < (off_t)sizeof (RecordHeader) 
+         || sb.st_size != SPOOL_SEGMENT_SIZE)
+      {
+      error = path + ": " + std::to_string ((long long)sb.st_size) 
+        + " bytes, not " + std::to_string (SPOOL_SEGMENT_SIZE);
+      close (fd);
+      return 0;
+      }
+    size = sb.st_size;
+    }
+  void *base = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping keeps the file open
+  close (fd);
+  if (base == MAP_FAILED)
+    {
+    error = path + ": " + strerror (errno);
+    if (create) unlink (path.c_str());
+    return 0;
+    }
+  Segment *s = new Segment();
+  s->path = path;
+  s->base = (char *)base;
+  s->size = size;
+  s->used = 0;
+  s->position = 0;
+  s->first_seq = first_seq;
+  s->last_seq = 0;
+  s->max_before = 0;
+  s->last_time = 0;
+  s->records = 0;
+  return s;
+  }
+
+void Spool::recover (Segment *s)
+  {
+  size_t offset = 0;
+  while (offset + sizeof (RecordHeader) <= s->size)
+    {
+    RecordHeader h;
+    memcpy (&h, s->base + offset, sizeof (h));
+    if (h.length == 0 || h.length > s->size - offset - sizeof (h)) break;
+    note (s, h.seq, h.time, offset);
+    offset += align8 (sizeof (h) + h.length);
+    }
+  s->used = offset;
+  }
+
+void Spool::note (Segment *s, uint64_t seq, int64_t time, size_t offset)
+  {
+  if (s->records % SPOOL_INDEX_INTERVAL == 0)
+    {
+    IndexEntry e;
+    e.max_before = max_seq;
+    e.offset = offset;
+    s->index.push_back (e);
+    }
+  if (s->records == 0) 
+    {
+    s->first_seq = seq;
+    s->max_before = max_seq;
+    }
+  max_seq = std::max (max_seq, seq);
+  s->last_seq = std::max (s->last_seq, seq);
+  s->last_time = time;
+  s->records++;
+  }
+
+void Spool::place (Segment *s)
+  {
+  s->position = next_position;
+  next_position += s->size;
+  segments.push_back (s);
+  total += s->size;
+  }
+
+/*=====================================================================
+
+  append
+
+=====================================================================*/
+void Spool::append (const Publication &p)
+  {
+  const std::vector<char>& buffer = p.encoded;
+  size_t need = align8 (sizeof (RecordHeader) + buffer.size());
+  if (need > SPOOL_SEGMENT_SIZE)
+    {
+    DWARN (log << "Message " << p.seq << " is too large to spool in "
+       << dir;)
+    return;
+    }
+  Segment *s = segments.empty() ? 0 : segments.back();
+  if (!s || s->used + need > s->size)
+    {
+    char name[32];
+    snprintf (name, sizeof (name), "%020llu.seg",
+      (unsigned long long)p.seq);
+    std::string error;
+    s = map (dir + "/" + name, p.seq, true, error);
+    if (!s)
+      {
+      if (!failing) DERR (log << "Can't create spool segment " << error;)
+      failing = true;
+      return;
+      }
+    failing = false;
+    place (s);
+    }
+
+  int64_t now = wall_ms();
+  RecordHeader h;
+  h.length = 0;
+  h.reserved = 0;
+  h.seq = p.seq;
+  h.time = now;
+  char *r = s->base + s->used;
+  memcpy (r + sizeof (h), buffer.data(), buffer.size());
+  memcpy (r, &h, sizeof (h));
+  // The length goes in last -- until it does, the record ends the
+  //   segment.
+  uint32_t length = buffer.size();
+  memcpy (r, &length, sizeof (length));
+  note (s, p.seq, now, s->used);
+  s->used += need;
+  Stats::count (Stats::SPOOLED);
+  trim (now);
+  }
+
+void Spool::remove_oldest()
+  {
+  Segment *s = segments.front();
+  DDBG (log << "Removing spool segment " << s->path;)
+  munmap (s->base, s->size);
+  unlink (s->path.c_str());
+  total -= s->size;
+  segments.pop_front();
+  delete s;
+  }
+
+void Spool::trim (int64_t now)
+  {
+  while (segments.size() > 1)
+    {
+    const Segment *s = segments.front();
+    bool too_big = total > max_bytes;
+    bool too_old = max_age > 0 && s->last_time < now - max_age;
+    if (!too_big && !too_old) break;
+    remove_oldest();
+    }
+  }
+
+uint64_t Spool::first() const
+  {
+  return segments.empty() ? 0 : segments.front()->first_seq;
+  }
+
+uint64_t Spool::last() const
+  {
+  return segments.empty() ? 0 : max_seq;
+  }
+
+/*=====================================================================
+
+  find
+
+=====================================================================*/
+uint64_t Spool::find (uint64_t from) const
+  {
+  if (segments.empty()) return 0;
+  // Start in the last segment whose earlier segments hold nothing at 
+  //   or after from, at the last index entry that the same is true 
+  //   of. Both only ever grow.
+  std::deque<Segment*>::const_iterator i = std::lower_bound 
+    (segments.begin(), segments.end(), from, 
+     [] (const Segment *s, uint64_t seq) { return s->max_before < seq; });
+  if (i == segments.begin()) return segments.front()->position;
+  const Segment *s = *(i - 1);
+  std::vector<IndexEntry>::const_iterator e = std::lower_bound
+    (s->index.begin(), s->index.end(), from,
+     [] (const IndexEntry &e, uint64_t seq) { return e.max_before < seq; });
+  return s->position + (e == s->index.begin() ? 0 : (e - 1)->offset);
+  }
+
+/*=====================================================================
+
+  read
+
+=====================================================================*/
+bool Spool::read (uint64_t position, uint64_t from, size_t max, 
+     PublicationList &list, uint64_t &next)
+  {
+  next = position;
+  // Start in the segment that holds the position
+  std::deque<Segment*>::const_iterator i = std::upper_bound 
+    (segments.begin(), segments.end(), position, 
+     [] (uint64_t p, const Segment *s) { return p < s->position; });
+  size_t offset = 0;
+  if (i != segments.begin()) 
+    {
+    i--;
+    offset = position - (*i)->position;
+    }
+  for (; i != segments.end(); i++, offset = 0)
+    {
+    const Segment *s = *i;
+    while (offset < s->used)
+      {
+      if (list.size() >= max) return false;
+      RecordHeader h;
+      memcpy (&h, s->base + offset, sizeof (h));
+      const char *data = s->base + offset + sizeof (h);
+      offset += align8 (sizeof (h) + h.length);
+      next = s->position + offset;
+      if (h.seq < from) continue;
+
+      Publication *pub = new Publication();
+      pub->encoded.assign (data, data + h.length);
+      try
+        {
+        message.decode (pub->encoded);
+        pub->set_fields (message);
+        }
+      catch (const proton::error &e)
+        {
+        DWARN (log << "Can't decode message " << h.seq << " in spool "
+           << dir << ": " << e.what();)
+        delete pub;
+        continue;
+        }
+      pub->seq = h.seq;
+      pub->published = Stats::now();
+      list.push_back (PublicationPtr (pub));
+      Stats::count (Stats::SPOOL_READ);
+      }
+    }
+  return true;
+  }
@@ -0,0 +1,204 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Spool.h
+
+  A Spool keeps the messages published to one Queue on disk, so that
+  a client that was not connected when they were published can
+  resume from the last message it saw, however long ago that was,
+  within the spool's retention limits.
+
+  The spool is a directory of segment files, each of SPOOL_SEGMENT_SIZE
+  bytes, named after the sequence number of the first message in it.
+  Each segment is memory-mapped, and messages are only ever appended,
+  so writing a message is a copy into memory -- the kernel writes the
+  pages out in its own time. A segment is a series of records, each
+  aligned to 8 bytes:
+
+  4 bytes  length of the encoded message, n
+  4 bytes  reserved (zero)
+  8 bytes  sequence number
+  8 bytes  time published, in msec since the epoch
+  n bytes  the message, AMQP-encoded
+
+  A zero length ends the segment. The length is written last, so a
+  record that was being written when the server stopped is ignored
+  when the spool is reopened.
+
+  When a message doesn't fit in the current segment, a new one is
+  started, and the oldest segments are deleted while the spool is
+  larger than its size limit, or older than its age limit. Retention
+  is by whole segments, so a spool can hold a little more than its
+  limits.
+
+  Messages are appended in the order they reach the Queue, which is
+  not quite the order of their sequence numbers, since publishers on
+  different threads number them. So a reader keeps its place by its
+  position in the spool -- the segment's position plus the record's 
+  offset -- not by sequence number, and takes every record with a 
+  sequence number at or after the one it started from.
+
+  To find where to start, the Spool keeps a sparse index of each 
+  segment, with the offset of every SPOOL_INDEX_INTERVAL'th record,
+  and the largest sequence number of all the records before it. That
+  only ever grows, so it can be searched, and a reader that starts
+  at the last entry whose records before are all earlier than the 
+  message it wants misses nothing.
+
+  A Spool is not thread-safe. Its Queue only uses it on its own
+  work queue.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <proton/message.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Publication.h"
+#include "QueuePolicy.h"
+
+class Spool
+  {
+  private:
+
+  /** An entry in a segment's sparse index. */
+  struct IndexEntry
+    {
+    /** The largest sequence number of the records before this one,
+        in this segment and the earlier ones. */
+    uint64_t max_before;
+    size_t offset;
+    };
+
+  /** One memory-mapped segment file. */
+  struct Segment
+    {
+    std::string path;
+    char *base;
+    /** The size of the file, and the mapping. */
+    size_t size;
+    /** Bytes of records, up to the first free byte. */
+    size_t used;
+    /** The position of the segment's first byte. See read(). */
+    uint64_t position;
+    uint64_t first_seq;
+    uint64_t last_seq;
+    /** The largest sequence number in the earlier segments. */
+    uint64_t max_before;
+    /** When the last record was written, in msec since the epoch. */
+    int64_t last_time;
+    size_t records;
+    std::vector<IndexEntry> index;
+    };
+
+  /** The directory that holds this spool's segments. */
+  std::string dir;
+
+  /** The most bytes of segments to keep. */
+  size_t max_bytes;
+
+  /** The oldest message to keep, in msec, or zero to keep messages
+      however old they are. */
+  int64_t max_age;
+
+  /** The segments, oldest first. The last one is written to. */
+  std::deque<Segment*> segments;
+
+  /** The total size of the segments, in bytes. */
+  size_t total;
+
+  /** The largest sequence number appended so far. */
+  uint64_t max_seq;
+
+  /** The position the next segment starts at. Positions start at one,
+      so that zero can mean none. */
+  uint64_t next_position;
+
+  /** Set when a segment could not be created, so that the error is
+      logged once, not for every message. */
+  bool failing;
+
+  /** Reused to decode messages read from the spool, to find their 
+      properties. */
+  proton::message message;
+
+  Spool (const std::string &dir, const QueuePolicy &policy);
+
+  /** Map a segment file, creating it at its full size if create is
+      set. Returns null, and sets error, if it fails, or if an 
+      existing file is not SPOOL_SEGMENT_SIZE long. */
+  static Segment *map (const std::string &path, uint64_t first_seq, 
+      bool create, std::string &error);
+
+  /** Read the records of a segment mapped from an existing file, to
+      find where it ends, and build its index. */
+  void recover (Segment *s);
+
+  /** Add the record at offset to a segment's index, and update its
+      first and last sequence numbers. */
+  void note (Segment *s, uint64_t seq, int64_t time, size_t offset);
+
+  /** Give a new segment, the last, its position in the spool. */
+  void place (Segment *s);
+
+  /** Unmap and delete the oldest segment. */
+  void remove_oldest();
+
+  /** Delete the oldest segments, while the spool is over its limits.
+      The segment being written is never deleted. */
+  void trim (int64_t now);
+
+  public:
+
+  ~Spool();
+
+  /** Open the spool in the directory dir, creating the directory if
+      necessary, and find the messages already in it. The policy gives
+      the retention limits. Returns null, and sets error, if the
+      directory can't be used. */
+  static Spool *open (const std::string &dir, const QueuePolicy &policy,
+      std::string &error);
+
+  /** Turn a queue name into something that can be used as a file
+      name: characters other than letters, digits, '.', '-' and '_'
+      become %XX. */
+  static std::string escape (const std::string &name);
+
+  /** Append a message. Messages are appended in the order they 
+      arrive, which need not be the order of their sequence 
+      numbers. */
+  void append (const Publication &p);
+
+  /** Get the sequence number of the oldest message in the spool, or
+      zero if it is empty. */
+  uint64_t first() const;
+
+  /** Get the sequence number of the newest message in the spool, or
+      zero if it is empty. */
+  uint64_t last() const;
+
+  /** Find where to start reading, for a reader that wants the 
+      messages with sequence numbers at or after from. Returns a 
+      position to pass to read(). */
+  uint64_t find (uint64_t from) const;
+
+  /** Read up to max messages with sequence numbers at or after from,
+      starting at the given position, and add them to list. Sets next
+      to the position to read from next time. If the position has 
+      been deleted, reading starts at the oldest message. Returns true
+      if there are no more messages in the spool, after the ones 
+      read. */
+  bool read (uint64_t position, uint64_t from, size_t max, 
+      PublicationList &list, uint64_t &next);
+  };
+
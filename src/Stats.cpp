@@ -0,0 +1,73 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Stats.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <string.h>
+#include <time.h>
+
+#include "Stats.h"
+
+std::atomic<Stats::Block*> Stats::blocks (0);
+
+Stats::Block::Block() : next (0)
+  {
+  for (int i = 0; i < COUNTERS; i++) 
+    counters[i].store (0, std::memory_order_relaxed);
+  for (int i = 0; i < HISTOGRAMS; i++) 
+    for (int j = 0; j < BUCKETS; j++) 
+      histograms[i][j].store (0, std::memory_order_relaxed);
+  }
+
+Stats::Block *Stats::new_block()
+  {
+  Block *b = new Block();
+  Block *head = blocks.load();
+  do
+    b->next = head;
+  while (!blocks.compare_exchange_weak (head, b));
+  return b;
+  }
+
+uint64_t Stats::now()
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+void Stats::snapshot (Snapshot &s)
+  {
+  memset (&s, 0, sizeof (s));
+  for (Block *b = blocks.load(); b; b = b->next)
+    {
+    for (int i = 0; i < COUNTERS; i++) 
+      s.counters[i] += b->counters[i].load (std::memory_order_relaxed);
+    for (int i = 0; i < HISTOGRAMS; i++) 
+      for (int j = 0; j < BUCKETS; j++) 
+        s.histograms[i][j] += 
+          b->histograms[i][j].load (std::memory_order_relaxed);
+    }
+  }
+
+uint64_t Stats::Snapshot::percentile (Histogram h, double fraction) const
+  {
+  uint64_t total = 0;
+  for (int i = 0; i < BUCKETS; i++) total += histograms[h][i];
+  if (total == 0) return 0;
+  uint64_t wanted = (uint64_t)(total * fraction);
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; i++)
+    {
+    seen += histograms[h][i];
+    // Report the top of the bucket
+    if (seen > wanted) return ((uint64_t)2 << i) - 1;
+    }
+  return ((uint64_t)2 << (BUCKETS - 1)) - 1;
+  }
+
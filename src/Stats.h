@@ -0,0 +1,182 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Stats.h
+
+  Counters and latency histograms for the server's own hot paths: 
+  publishing, fan-out, and delivery. These are published periodically
+  on the queue "$sys.stats", so the server can be watched using the
+  same protocol as everything else.
+
+  Updating a statistic must cost next to nothing, because it happens
+  for every message and every delivery. So each thread has its own 
+  block of counters, which only that thread writes. There are no 
+  locks, and no atomic read-modify-write instructions: a counter is 
+  an atomic only so that the thread that reads all the blocks, and 
+  adds them up, sees a consistent value. The blocks are never freed,
+  so the totals don't go backwards when a thread ends.
+
+  Histograms have one bucket for each power of two nanoseconds, so 
+  percentiles are accurate to within a factor of two. That is 
+  enough to see whether latency is microseconds or milliseconds.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+class Stats
+  {
+  public:
+
+  enum Counter
+    {
+    /** Messages published by the QueueManager. */
+    PUBLISHED,
+    /** Work items scheduled by Queues to deliver a message to the
+        subscribers on a connection. */
+    FANOUT_ITEMS,
+    /** Messages passed to a Sender for delivery. */
+    DELIVERIES,
+    /** Messages actually sent to clients. */
+    SENT,
+    /** Batches of messages sent to clients that asked for them. */
+    BATCHES,
+    /** Messages buffered by a Sender for lack of credit. */
+    BUFFERED,
+    /** Messages discarded by a Sender whose buffer was full. */
+    DROPPED,
+    /** Work items added to, and run on, the Queues' work queues. */
+    QUEUE_WORK_ADDED,
+    QUEUE_WORK_DONE,
+    /** Work items added to, and run on, connections' work queues, 
+        which are shared by the Senders on the connection. */
+    SENDER_WORK_ADDED,
+    SENDER_WORK_DONE,
+    /** Work items added to, and run on, the QueueManager's work 
+        queue. */
+    MANAGER_WORK_ADDED,
+    MANAGER_WORK_DONE,
+    /** Messages received on the ingest socket and published. */
+    INGESTED,
+    /** Records and datagrams rejected by the ingest socket, because
+        they were malformed, or for a reserved or wildcard queue. */
+    INGEST_REJECTED,
+    /** Messages received from clients on Receiver links, and 
+        published. */
+    RECEIVED,
+    /** Messages from clients that were rejected, because they were
+        for a reserved or wildcard queue, or not text. */
+    RECEIVE_REJECTED,
+    /** Times a Receiver had to wait for the Queues to catch up, 
+        before it could give its client more credit. */
+    RECEIVER_STALLS,
+    /** Messages written to queue spools. */
+    SPOOLED,
+    /** Messages read back from queue spools, for clients that 
+        resumed. */
+    SPOOL_READ,
+    /** Messages written to shared memory rings. */
+    SHM_WRITTEN,
+    /** Idle queues deleted. */
+    QUEUES_RECLAIMED,
+    /** Queues not created, because there were too many. */
+    QUEUES_REFUSED,
+    COUNTERS
+    };
+
+  enum Histogram
+    {
+    /** Time taken by QueueManager::publish(). */
+    PUBLISH_TIME,
+    /** Time from publishing a message, to a Queue running
+        queueMsg() for it. */
+    QUEUE_LATENCY,
+    /** Time from publishing a message, to a Sender sending it. */
+    SEND_LATENCY,
+    HISTOGRAMS
+    };
+
+  /** The number of buckets in a histogram. Bucket n counts times 
+      from 2^n to 2^(n+1)-1 nanoseconds; the last bucket counts 
+      anything longer. */
+  static const int BUCKETS = 40;
+
+  /** The totals of all the threads' statistics. */
+  class Snapshot
+    {
+    public:
+    uint64_t counters[COUNTERS];
+    uint64_t histograms[HISTOGRAMS][BUCKETS];
+
+    /** Get the approximate time, in nanoseconds, below which the 
+        given fraction (like 0.99) of the times in the histogram 
+        fell. Returns zero if the histogram is empty. */
+    uint64_t percentile (Histogram h, double fraction) const;
+    };
+
+  /** Add to a counter for the calling thread. */
+  static void count (Counter c, uint64_t n = 1)
+    {
+    std::atomic<uint64_t> &a = block().counters[c];
+    a.store (a.load (std::memory_order_relaxed) + n, 
+      std::memory_order_relaxed);
+    }
+
+  /** Record a time, in nanoseconds, in a histogram for the calling
+      thread. */
+  static void record (Histogram h, uint64_t ns)
+    {
+    std::atomic<uint64_t> &a = block().histograms[h][bucket (ns)];
+    a.store (a.load (std::memory_order_relaxed) + 1, 
+      std::memory_order_relaxed);
+    }
+
+  /** The time now, in nanoseconds on the monotonic clock. */
+  static uint64_t now();
+
+  /** Add up the statistics of every thread. This method is 
+      thread-safe, and does not stop other threads updating their
+      statistics. */
+  static void snapshot (Snapshot &s);
+
+  private:
+
+  /** One thread's statistics. */
+  class Block
+    {
+    public:
+    std::atomic<uint64_t> counters[COUNTERS];
+    std::atomic<uint64_t> histograms[HISTOGRAMS][BUCKETS];
+    Block *next;
+    Block();
+    };
+
+  /** The list of all the threads' Blocks. New blocks are pushed on
+      the front, and never removed, so readers can walk the list 
+      without locking. */
+  static std::atomic<Block*> blocks;
+
+  /** Get the calling thread's Block, creating it the first time. */
+  static Block &block()
+    {
+    static thread_local Block *b = 0;
+    if (!b) b = new_block();
+    return *b;
+    }
+
+  static Block *new_block();
+
+  static int bucket (uint64_t ns)
+    {
+    int b = 63 - __builtin_clzll (ns | 1);
+    return b < BUCKETS ? b : BUCKETS - 1;
+    }
+  };
+
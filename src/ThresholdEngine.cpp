@@ -0,0 +1,66 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ThresholdEngine.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <iostream>
+
+#include "ThresholdEngine.h"
+#include "Server.h"
+#include "logging.h"
+
+ThresholdEngine::ThresholdEngine (Server *_server, 
+      const TriggerList &_triggers) : 
+    server (_server), triggers (_triggers)
+  {
+  for (size_t i = 0; i < triggers.size(); i++)
+    {
+    Trigger *t = triggers[i];
+    index[t->get_metric()].push_back (t);
+    DINFO (log << "Trigger on " << t->get_metric() << " rises above " 
+      << t->get_rise() << ", clears at " << t->get_clear() 
+      << ", alerts on " << t->get_queue();)
+    }
+  }
+
+ThresholdEngine::~ThresholdEngine()
+  {
+  for (size_t i = 0; i < triggers.size(); i++)
+    delete triggers[i];
+  }
+
+void ThresholdEngine::sample (const std::string &metric, double time, 
+      double value)
+  {
+  TriggerIndex::iterator i = index.find (metric);
+  if (i == index.end()) return;
+
+  TriggerList &list = i->second;
+  for (size_t j = 0; j < list.size(); j++)
+    {
+    Trigger *t = list[j];
+    Trigger::Transition transition = t->sample (time, value);
+    if (transition == Trigger::NONE) continue;
+
+    bool raised = transition == Trigger::RAISED;
+    DINFO (log << t->get_text() << (raised ? " raised" : " cleared") 
+       << ": " << metric << " is " << t->get_current();)
+
+    // The statistic and the level are sent as properties, so that 
+    //   clients can use selectors like "value > 2" to see only the 
+    //   worst alerts, or "state = 'raised'" to ignore the clears
+    proton::message::property_map props;
+    props.put ("metric", metric);
+    props.put ("value", t->get_current());
+    props.put ("threshold", raised ? t->get_rise() : t->get_clear());
+    props.put ("state", std::string (raised ? "raised" : "cleared"));
+    server->publish (t->get_queue(), 
+      raised ? t->get_text() : t->get_text() + " cleared", props);
+    }
+  }
+
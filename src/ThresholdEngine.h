@@ -0,0 +1,53 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  ThresholdEngine.h
+
+  The ThresholdEngine holds the Triggers, and feeds each metric sample
+  to the Triggers that watch that metric. When a Trigger changes 
+  state, the engine publishes an alert to the Trigger's queue -- once
+  when the alert is raised, and once when it clears, never on every
+  sample.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Trigger.h"
+
+class Server;
+
+/** A list of Triggers. Whoever holds the list owns the Triggers. */
+typedef std::vector<Trigger*> TriggerList;
+
+class ThresholdEngine
+  {
+  private:
+
+  typedef std::unordered_map<std::string, TriggerList> TriggerIndex;
+
+  Server *server;
+  TriggerList triggers;
+  /** The triggers for each metric name. Metrics with no triggers 
+      are not in the index. */
+  TriggerIndex index;
+
+  public:
+
+  /** Create an engine that publishes alerts using the server. The 
+      engine takes ownership of the triggers. */
+  ThresholdEngine (Server *server, const TriggerList &triggers);
+  ~ThresholdEngine();
+
+  /** Pass a sample, taken at the given time in seconds, to the 
+      triggers for the metric, and publish any alerts. */
+  void sample (const std::string &metric, double time, double value);
+  };
+
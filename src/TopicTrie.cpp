@@ -0,0 +1,184 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  TopicTrie.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "TopicTrie.h"
+
+/** The nodes reached by the levels of an address matched so far, and
+    by the next level. A node is marked with the number of the step 
+    in which it was last reached, so it can be added to a set only 
+    once, without searching the set. Each thread has one, which it 
+    reuses for every match, in any TopicTrie, so matching doesn't 
+    allocate, and doesn't write to the trie. */
+class TopicTrie::MatchState
+  {
+  public:
+  std::vector<int> reached;
+  std::vector<int> next;
+  std::vector<uint64_t> marks;
+  uint64_t step;
+  MatchState() : step (0) {}
+  };
+
+TopicTrie::TopicTrie() : nodes (1)
+  {
+  }
+
+bool TopicTrie::is_pattern (const std::string& address)
+  {
+  size_t start = 0;
+  while (true)
+    {
+    size_t end = address.find ('.', start);
+    if (end == std::string::npos) end = address.size();
+    if (end - start == 1 && 
+         (address[start] == '*' || address[start] == '#')) 
+      return true;
+    if (end == address.size()) return false;
+    start = end + 1;
+    }
+  }
+
+int TopicTrie::find_child (int n, const std::string& address, size_t start,
+      size_t end) const
+  {
+  const std::vector<std::pair<std::string, int> >& c = nodes[n].children;
+  size_t len = end - start;
+  for (size_t i = 0; i < c.size(); i++)
+    {
+    if (c[i].first.size() == len && 
+         memcmp (c[i].first.data(), address.data() + start, len) == 0)
+      return c[i].second;
+    }
+  return -1;
+  }
+
+void TopicTrie::add (const std::string& pattern, Queue* q)
+  {
+  int n = 0;
+  size_t start = 0;
+  bool prev_hash = false;
+  while (true)
+    {
+    size_t end = pattern.find ('.', start);
+    if (end == std::string::npos) end = pattern.size();
+    std::string level = pattern.substr (start, end - start);
+
+    // Note that nodes.push_back() can move the nodes, so we must not
+    //   hold a reference to a node across it.
+    int next;
+    if (level == "*")
+      {
+      next = nodes[n].star;
+      if (next < 0)
+        {
+        next = nodes.size();
+        nodes.push_back (Node());
+        nodes[n].star = next;
+        }
+      }
+    else if (level == "#")
+      {
+      // "#.#" is the same as "#", and treating it as such saves 
+      //   needless backtracking when matching.
+      if (prev_hash)
+        next = n;
+      else
+        {
+        next = nodes[n].hash;
+        if (next < 0)
+          {
+          next = nodes.size();
+          nodes.push_back (Node());
+          nodes[next].loops = true;
+          nodes[n].hash = next;
+          }
+        }
+      }
+    else
+      {
+      next = find_child (n, pattern, start, end);
+      if (next < 0)
+        {
+        next = nodes.size();
+        nodes.push_back (Node());
+        nodes[n].children.push_back (std::make_pair (level, next));
+        }
+      }
+    n = next;
+    prev_hash = (level == "#");
+
+    if (end == pattern.size()) break;
+    start = end + 1;
+    }
+
+  std::vector<Queue*>& qs = nodes[n].queues;
+  if (std::find (qs.begin(), qs.end(), q) == qs.end())
+    qs.push_back (q);
+  }
+
+void TopicTrie::reach (MatchState& m, int n) const
+  {
+  // A "#" node has no "#" child, because "#.#" is stored as "#", so
+  //   this stops after a few steps.
+  while (n >= 0 && m.marks[n] != m.step)
+    {
+    m.marks[n] = m.step;
+    m.next.push_back (n);
+    n = nodes[n].hash;
+    }
+  }
+
+void TopicTrie::match (const std::string& address, 
+      std::vector<Queue*>& out) const
+  {
+  if (empty()) return;
+  static thread_local MatchState m;
+  if (m.marks.size() < nodes.size()) m.marks.resize (nodes.size(), 0);
+  m.next.clear();
+  m.step++;
+  reach (m, 0);
+
+  size_t pos = 0;
+  while (true)
+    {
+    size_t end = address.find ('.', pos);
+    if (end == std::string::npos) end = address.size();
+
+    m.reached.swap (m.next);
+    m.next.clear();
+    m.step++;
+    for (size_t i = 0; i < m.reached.size(); i++)
+      {
+      int n = m.reached[i];
+      const Node& node = nodes[n];
+      if (!node.children.empty()) 
+        reach (m, find_child (n, address, pos, end));
+      if (node.star >= 0) reach (m, node.star);
+      if (node.loops) reach (m, n);
+      }
+    if (m.next.empty()) return;
+
+    if (end == address.size()) break;
+    pos = end + 1;
+    }
+
+  // Each Queue's pattern ends at one node, and each node is reached 
+  //   once
+  for (size_t i = 0; i < m.next.size(); i++)
+    {
+    const std::vector<Queue*>& qs = nodes[m.next[i]].queues;
+    out.insert (out.end(), qs.begin(), qs.end());
+    }
+  }
@@ -0,0 +1,101 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  TopicTrie.h
+
+  A TopicTrie is an index of wildcard address patterns, used to find
+  the wildcard Queues that a published message should go to.
+
+  Addresses are hierarchical, with levels separated by dots, for 
+  example "host.cpu.load". In a pattern, a level "*" matches exactly
+  one level of an address, and a level "#" matches zero or more 
+  levels. So "host.net.*" matches "host.net.eth0" but not 
+  "host.net.eth0.rx", while "host.#" matches both, and "host" as 
+  well. This is the same scheme as AMQP 0-9-1 topic exchanges use.
+
+  Patterns are stored in a trie, one node per level. An address is
+  matched one level at a time, keeping the set of nodes that the 
+  levels so far have reached, as in a non-deterministic automaton: a
+  "#" node stays in the set as more levels are consumed, and reaching
+  a node also reaches its "#" child, which can match zero levels. So
+  matching costs time in proportion to the number of levels in the 
+  address, times the number of nodes reached at each -- never more
+  than the number of patterns that could still match -- however many
+  "#" levels the patterns have, and however the address is split.
+
+  The trie stores its nodes in a vector, and refers to them by index,
+  so copying a TopicTrie makes a complete, independent copy. That is
+  how the QueueRegistry builds a new snapshot.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class Queue;
+
+class TopicTrie
+  {
+  private:
+
+  class Node
+    {
+    public:
+    /** Children for literal levels, as (level, node index) pairs.
+        There are usually few enough that a linear search is faster
+        than a map, and it needs no temporary strings. */
+    std::vector<std::pair<std::string, int> > children;
+    /** Index of the "*" child, or -1. */
+    int star;
+    /** Index of the "#" child, or -1. */
+    int hash;
+    /** Set if this node is a "#" level, which can consume any 
+        number of levels, so stays reached as it does so. */
+    bool loops;
+    /** The Queues whose pattern ends at this node. */
+    std::vector<Queue*> queues;
+    Node() : star (-1), hash (-1), loops (false) {}
+    };
+
+  /** The nodes reached while matching, on one thread. */
+  class MatchState;
+
+  /** All the nodes. Node 0 is the root. */
+  std::vector<Node> nodes;
+
+  /** Find the literal child of node n that matches the level
+      address[start,end), or return -1. */
+  int find_child (int n, const std::string& address, size_t start, 
+      size_t end) const;
+
+  /** Add node n, and the "#" node that can follow it without 
+      consuming a level, to the nodes reached by the current level, 
+      unless they are there already. */
+  void reach (MatchState& m, int n) const;
+
+  public:
+
+  TopicTrie();
+
+  /** Returns true if the address is a pattern -- that is, it contains
+      a "*" or "#" level. */
+  static bool is_pattern (const std::string& address);
+
+  /** Add a pattern, and the Queue that subscribes to it. */
+  void add (const std::string& pattern, Queue* q);
+
+  /** Add to out every Queue whose pattern matches the address. Each 
+      Queue is added only once, even if its pattern matches in more than
+      one way. This method is thread-safe. */
+  void match (const std::string& address, std::vector<Queue*>& out) const;
+
+  /** Returns true if there are no patterns. */
+  bool empty() const { return nodes.size() == 1; }
+  };
+
@@ -0,0 +1,159 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Trigger.cpp
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#include <stdlib.h>
+
+#include "Trigger.h"
+#include "config.h"
+
+Trigger::Trigger (const std::string &m, const std::string &q,
+       const std::string &t, double level) :
+        metric (m), queue (q), text (t), statistic (VALUE), rise (level),
+        clear (level), duration (0), alpha (DEFAULT_TRIGGER_ALPHA),
+        window_size (DEFAULT_TRIGGER_WINDOW), sum (0), ewma (0), count (0),
+        raised (false), pending_since (-1), current (0)
+  {
+  window.reset (window_size);
+  maxima.reset (window_size);
+  }
+
+const char *Trigger::name_of (Statistic s)
+  {
+  switch (s)
+    {
+    case VALUE: return "value";
+    case EWMA: return "ewma";
+    case MEAN: return "mean";
+    case MAX: return "max";
+    case SLOPE: return "slope";
+    }
+  return "unknown";
+  }
+
+Trigger *Trigger::parse (const std::string &spec, std::string &error)
+  {
+  Trigger *t = new Trigger ("", "", "", 0);
+  bool have_rise = false, have_clear = false;
+  size_t start = 0;
+  while (start <= spec.size())
+    {
+    size_t end = spec.find (',', start);
+    if (end == std::string::npos) end = spec.size();
+    std::string item = spec.substr (start, end - start);
+    start = end + 1;
+    if (item.empty()) continue;
+
+    size_t eq = item.find ('=');
+    std::string key = item.substr (0, eq);
+    std::string value = eq == std::string::npos ? "" : item.substr (eq + 1);
+    char *e = 0;
+    double n = strtod (value.c_str(), &e);
+    bool numeric = !value.empty() && *e == 0;
+
+    if (key == "metric") t->metric = value;
+    else if (key == "queue") t->queue = value;
+    else if (key == "text") t->text = value;
+    else if (key == "rise" && numeric) { t->rise = n; have_rise = true; }
+    else if (key == "clear" && numeric) { t->clear = n; have_clear = true; }
+    else if (key == "for" && numeric && n >= 0) t->duration = n;
+    else if (key == "alpha" && numeric && n > 0 && n <= 1) t->alpha = n;
+    else if (key == "window" && numeric && n >= 2) t->window_size = n;
+    else if (key == "stat")
+      {
+      if (value == "value") t->statistic = VALUE;
+      else if (value == "ewma") t->statistic = EWMA;
+      else if (value == "mean") t->statistic = MEAN;
+      else if (value == "max") t->statistic = MAX;
+      else if (value == "slope") t->statistic = SLOPE;
+      else { error = "unknown statistic " + value; delete t; return 0; }
+      }
+    else
+      {
+      error = "invalid setting " + item;
+      delete t;
+      return 0;
+      }
+    }
+
+  if (t->metric.empty() || !have_rise)
+    {
+    error = "metric and rise must be given";
+    delete t;
+    return 0;
+    }
+  if (!have_clear) t->clear = t->rise;
+  if (t->clear > t->rise)
+    {
+    error = "clear level must not be above rise level";
+    delete t;
+    return 0;
+    }
+  if (t->queue.empty()) t->queue = "alert." + t->metric;
+  if (t->text.empty()) t->text = t->metric + " alert";
+  t->window.reset (t->window_size);
+  t->maxima.reset (t->window_size);
+  return t;
+  }
+
+Trigger::Transition Trigger::sample (double time, double value)
+  {
+  uint64_t seq = count++;
+
+  // The window of the last N samples, and its running sum
+  if (window.full())
+    {
+    sum -= window.front().value;
+    window.pop_front();
+    }
+  window.push_back (Sample (time, value, seq));
+  sum += value;
+
+  // The monotonic queue for the maximum: drop samples that have left
+  //   the window, and samples that can never be the maximum because
+  //   this one is at least as large and will outlive them.
+  if (!maxima.empty() && maxima.front().seq + window_size <= seq)
+    maxima.pop_front();
+  while (!maxima.empty() && maxima.back().value <= value)
+    maxima.pop_back();
+  maxima.push_back (Sample (time, value, seq));
+
+  ewma = (seq == 0) ? value : alpha * value + (1 - alpha) * ewma;
+
+  switch (statistic)
+    {
+    case VALUE: current = value; break;
+    case EWMA: current = ewma; break;
+    case MEAN: current = sum / window.size(); break;
+    case MAX: current = maxima.front().value; break;
+    case SLOPE:
+      {
+      double dt = window.back().time - window.front().time;
+      current = dt > 0 ? 
+        (window.back().value - window.front().value) / dt : 0;
+      }
+      break;
+    }
+
+  // Is the condition for changing state met? If so, has it been met
+  //   for long enough?
+  bool change = raised ? (current <= clear) : (current > rise);
+  if (!change)
+    {
+    pending_since = -1;
+    return NONE;
+    }
+  if (pending_since < 0) pending_since = time;
+  if (time - pending_since < duration) return NONE;
+
+  pending_since = -1;
+  raised = !raised;
+  return raised ? RAISED : CLEARED;
+  }
+
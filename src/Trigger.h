@@ -0,0 +1,117 @@
+/*=====================================================================
+
+  amqp-monitor
+
+  Trigger.h
+
+  A Trigger watches one metric, and raises an alert when a statistic
+  of that metric rises above a level, and clears it when the 
+  statistic falls below another level. The statistic can be:
+
+    value   -- the latest sample
+    ewma    -- an exponentially-weighted moving average
+    mean    -- the mean of the last N samples
+    max     -- the maximum of the last N samples
+    slope   -- the rate of change, per second, over the last N samples
+
+  Using a clear level below the rise level (hysteresis) stops the
+  alert flapping when the metric hovers around the threshold. A 
+  minimum duration makes the alert wait until the condition has held
+  for that long -- "sustained for 30 seconds".
+
+  Each sample is processed in constant time: the last N samples are
+  kept in a RingBuffer, the mean is a running sum, and the maximum is
+  kept using a monotonic queue -- a second RingBuffer holding only 
+  the samples that could still become the maximum.
+
+  Copyright (c)2022 Kevin Boone, GPL v3.0
+
+=====================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "RingBuffer.h"
+
+class Trigger
+  {
+  public:
+
+  enum Statistic { VALUE, EWMA, MEAN, MAX, SLOPE };
+
+  /** The result of adding a sample. */
+  enum Transition { NONE, RAISED, CLEARED };
+
+  private:
+
+  class Sample
+    {
+    public:
+    double time;
+    double value;
+    uint64_t seq;
+    Sample() : time (0), value (0), seq (0) {}
+    Sample (double t, double v, uint64_t s) : time (t), value (v), seq (s) {}
+    };
+
+  // Configuration
+
+  std::string metric;
+  std::string queue;
+  std::string text;
+  Statistic statistic;
+  double rise;
+  double clear;
+  double duration;
+  double alpha;
+  size_t window_size;
+
+  // State
+
+  RingBuffer<Sample> window;
+  RingBuffer<Sample> maxima;
+  double sum;
+  double ewma;
+  uint64_t count;
+  bool raised;
+  /** When the condition for changing state started to hold, or a
+      negative number if it doesn't hold. */
+  double pending_since;
+  double current;
+
+  public:
+
+  /** Create a Trigger with default settings: the latest value of the 
+      metric, rising above and clearing at the same level, with no 
+      minimum duration. */
+  Trigger (const std::string &metric, const std::string &queue,
+      const std::string &text, double level);
+
+  /** Parse a trigger specification of the form
+        metric=NAME,rise=N[,clear=N][,stat=S][,window=N][,for=SECS]
+          [,alpha=N][,queue=NAME][,text=TEXT]
+      Returns null, and sets error, if the specification is invalid. 
+      The caller owns the returned object. */
+  static Trigger *parse (const std::string &spec, std::string &error);
+
+  /** Add a sample, taken at the given time in seconds. Returns 
+      RAISED or CLEARED if the alert changed state. */
+  Transition sample (double time, double value);
+
+  const std::string& get_metric() const { return metric; }
+  const std::string& get_queue() const { return queue; }
+  const std::string& get_text() const { return text; }
+  double get_rise() const { return rise; }
+  double get_clear() const { return clear; }
+
+  /** The value of the statistic after the latest sample. */
+  double get_current() const { return current; }
+
+  /** Return the name of a statistic, for logging and alert 
+      messages. */
+  static const char *name_of (Statistic s);
+  };
+
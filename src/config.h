@@ -14,13 +14,172 @@
 
 #pragma once
 
-// Time in usec between status checks
-#define TICK_INTERVAL 1000000
+// Time in msec between "tick" messages
+#define TICK_INTERVAL 1000
+
+// Default times in msec between samples, for each collector. These 
+//   can be changed using --interval
+#define LOADAVG_INTERVAL 1000
+#define STAT_INTERVAL 1000
+#define MEMINFO_INTERVAL 1000
+#define DISKSTATS_INTERVAL 1000
+#define NETDEV_INTERVAL 1000
+
+// Time in msec between the server's own statistics messages, on 
+//   SYS_STATS_QUEUE. This can be changed using --interval stats=msec
+#define STATS_INTERVAL 10000
+
+// The resolution of the scheduler that runs the collectors, in msec.
+//   No interval can be shorter than this
+#define SCHEDULER_RESOLUTION 10
+
+// The number of slots in the scheduler's timing wheel. Intervals up
+//   to SCHEDULER_RESOLUTION * SCHEDULER_SLOTS msec can be scheduled 
+//   without any wasted wakeups
+#define SCHEDULER_SLOTS 512
 
 // The name of the queue that will publish "tick" messages
 #define TICK_QUEUE "tick"
 
+// Queue names starting with this are reserved for the server. Other 
+//   processes can't publish to them through the ingest socket
+#define SYS_QUEUE_PREFIX "$sys."
+
+// Queue on which the server publishes statistics about itself
+#define SYS_STATS_QUEUE SYS_QUEUE_PREFIX "stats"
+
 // The name of the queue that will publish CPU load alerts
 #define LOAD_QUEUE "load"
 
 
+
+// The number of messages that can be buffered for each subscriber, 
+//   while waiting for the client to grant link credit. This can be
+//   changed per-queue using --queue-policy
+#define DEFAULT_SENDER_BUFFER 1000
+
+// What to do when a subscriber's buffer is full: SLOW_DROP_OLDEST,
+//   SLOW_DROP_NEWEST, or SLOW_DISCONNECT
+#define DEFAULT_SLOW_CONSUMER_POLICY SLOW_DROP_OLDEST
+
+// The number of recent messages each queue keeps, and delivers to a
+//   new subscriber straight away, so it learns the current state 
+//   without waiting for the next publication. This can be changed
+//   per-queue using --queue-policy name=last=N
+#define DEFAULT_LAST_VALUES 1
+
+// The number of recent messages each queue keeps for clients that 
+//   reconnect, and ask to resume from a sequence number, with an 
+//   address like "load?from=1234". This can be changed per-queue 
+//   using --queue-policy name=replay=N
+#define DEFAULT_REPLAY_SIZE 100
+
+// The directory that holds the spools of queues that have them, with
+//   a subdirectory for each queue. This can be changed using --spool-dir
+#define DEFAULT_SPOOL_DIR "/var/spool/" NAME
+
+// The most megabytes of messages a queue's spool keeps, and the oldest
+//   messages it keeps, in seconds (0 is no limit). These can be changed
+//   per-queue using --queue-policy name=spool-mb=N,spool-age=S
+#define DEFAULT_SPOOL_MB 64
+#define DEFAULT_SPOOL_AGE 0
+
+// The size of each file in a spool, in bytes. Space is reclaimed a
+//   whole file at a time. No message can be larger than this
+#define SPOOL_SEGMENT_SIZE (4 * 1024 * 1024)
+
+// How many messages apart the entries in a spool file's index are. A
+//   lookup reads at most this many messages to find the one it wants
+#define SPOOL_INDEX_INTERVAL 64
+
+// The directory for the shared memory rings of queues that have them.
+//   Each queue's ring is a file named after the program and the queue,
+//   like /dev/shm/amqp-monitor.loadavg.1
+#define SHM_DIR "/dev/shm"
+
+// The number of message slots in a shared memory ring, rounded up to
+//   a power of two. This can be changed per-queue using 
+//   --queue-policy name=shm=N
+#define DEFAULT_SHM_SLOTS 4096
+
+// The size of each slot in a shared memory ring, in bytes, which must
+//   be a multiple of 64. Longer messages are truncated
+#define SHM_SLOT_SIZE 256
+
+// The message property that holds the conflation key, on queues that
+//   conflate. Messages without it are conflated by the name of the 
+//   queue they were published to.
+#define CONFLATION_KEY "key"
+
+// The most deeply a message selector can nest NOT, signs and 
+//   parentheses, and the most nodes its expression tree can have. 
+//   Clients that supply longer selectors are refused
+#define SELECTOR_MAX_DEPTH 32
+#define SELECTOR_MAX_NODES 500
+
+// The most messages a client can ask for in one batch, with an address
+//   like "cpu.#?batch=100", and how long a message waits for its batch 
+//   to fill if the client doesn't say, with "batch-us=T". By default,
+//   that is one scheduler slot, which is long enough to collect all
+//   the metrics from one run of a collector
+#define MAX_BATCH_SIZE 10000
+#define DEFAULT_BATCH_US (SCHEDULER_RESOLUTION * 1000)
+
+// The message property that holds the number of messages in a batch
+#define BATCH_PROPERTY "batch"
+
+// The most queues there can be. Clients that subscribe to, or publish
+//   to, other queues are refused if every queue is in use. This 
+//   can be changed using --max-queues
+#define DEFAULT_MAX_QUEUES 10000
+
+// How long a queue must have had no subscribers, and no clients 
+//   publishing to it, before it is reclaimed, in seconds, and how often
+//   to look for such queues, in msec
+#define QUEUE_IDLE_GRACE 60
+#define QUEUE_RECLAIM_INTERVAL 10000
+
+// How long a queue keeps its last values, and replay history, after the
+//   last message published to it, if nobody is using it, in seconds. 
+//   Queues are created by publishing, as well as by subscribing, so 
+//   these are kept for clients that subscribe later. Unused queues are
+//   also reclaimed, oldest first, when there are max_queues
+#define QUEUE_KEEP 86400
+
+// The number of unused Senders and ConnectionHandlers that the pools
+//   have room for at first. Clients that connect and disconnect 
+//   frequently reuse these, rather than allocating new ones. Pooled 
+//   objects are never freed
+#define SENDER_POOL_SIZE 1024
+#define CONNECTION_POOL_SIZE 256
+
+// The most datagrams the ingest socket reads with one system call, 
+//   and the longest datagram it accepts, in bytes
+#define INGEST_BATCH 64
+#define INGEST_DATAGRAM_SIZE 16384
+
+// The receive buffer size requested for the ingest socket, in bytes.
+//   Datagrams that arrive while the buffer is full are lost
+#define INGEST_SOCKET_BUFFER (4 * 1024 * 1024)
+
+// The most messages a client publishing on a Receiver link can have
+//   in flight: its link credit, plus the messages the Queues have not 
+//   yet fanned out. Credit is granted at least RECEIVER_CREDIT_BATCH 
+//   at a time
+#define RECEIVER_WINDOW 1000
+#define RECEIVER_CREDIT_BATCH 250
+
+// The prefix of the load average metrics, which are published to the
+//   queues loadavg.1, loadavg.5 and loadavg.15
+#define LOADAVG_METRIC "loadavg"
+
+// The load average metric that triggers CPU load alerts
+#define LOAD_ALERT_METRIC LOADAVG_METRIC ".1"
+
+// The number of samples in the window of a --trigger, if it does not
+//   specify one
+#define DEFAULT_TRIGGER_WINDOW 10
+
+// The smoothing factor for the "ewma" statistic of a --trigger, if it
+//   does not specify one. Larger values follow the metric more closely
+#define DEFAULT_TRIGGER_ALPHA 0.3
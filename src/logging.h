@@ -6,6 +6,16 @@
 
   Logging functions. I've defined these as macros, so they can
   be compiled out completely, if no diagnostic output is required.
+  Levels above LOG_COMPILE_LEVEL generate no code at all; levels at
+  or below it are enabled at run time by log_level. 
+
+  Each macro makes a LogRecord called "log", and the argument writes
+  to it:
+
+  DINFO (log << "Queue " << name << " created";)
+
+  Records are written out by a background thread (see Logger.h), so 
+  logging does not block the thread that does it.
 
   Copyright (c)2022 Kevin Boone, GPL v3.0
 
@@ -13,10 +23,35 @@
 
 #pragma once
 
-#define DDBG(x) {if (log_level >= 3) {std::cout << "DEBUG "; x}}
-#define DINFO(x) {if (log_level >= 2) {std::cout << "INFO "; x}}
-#define DWARN(x) {if (log_level >= 1) {std::cout << "WARN "; x}}
-#define DERR(x) { std::cout << "ERROR "; {x}}
+#include "Logger.h"
+
+// The most detailed level that is compiled in: 0-3. Set this with 
+//   make LOG_COMPILE_LEVEL=n
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 3
+#endif
+
+#if LOG_COMPILE_LEVEL >= 3
+#define DDBG(x) {if (log_level >= 3) {LogRecord log (3); x}}
+#else
+#define DDBG(x) {}
+#endif
+
+#if LOG_COMPILE_LEVEL >= 2
+#define DINFO(x) {if (log_level >= 2) {LogRecord log (2); x}}
+#else
+#define DINFO(x) {}
+#endif
+
+#if LOG_COMPILE_LEVEL >= 1
+#define DWARN(x) {if (log_level >= 1) {LogRecord log (1); x}}
+#else
+#define DWARN(x) {}
+#endif
+
+// Errors are always compiled in, and written out straight away, since 
+//   the program may be about to stop
+#define DERR(x) {{LogRecord log (0); x} Logger::flush();}
 
 // Log level: 0-3
 extern int log_level;
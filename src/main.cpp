@@ -13,9 +13,12 @@
 =====================================================================*/
 
 #include <iostream>
+#include <map>
 #include <thread>
 #include <getopt.h>
 
+#include "config.h"
+#include "Ingest.h"
 #include "monitor_thread.h"
 #include "Server.h"
 #include "logging.h"
@@ -30,9 +33,71 @@ int log_level = 2;
 void show_help (void)
   {
   std::cout << NAME << " [options]" << std::endl;
-  std::cout << "   -c, --cpu-load  load average trigger point (0.9)" 
+  std::cout << "   -c, --cpu-load  rise[:clear[:seconds]]" << std::endl;
+  std::cout << "                   load average alert level (0.9), clear"
+    << std::endl;
+  std::cout << "                   level, and how long it must be sustained"
+    << std::endl;
+  std::cout << "   -i, --interval  name=msec" << std::endl;
+  std::cout << "                   sample interval for a collector (loadavg,"
+    << std::endl;
+  std::cout << "                   stat, meminfo, diskstats, netdev, tick,"
+    << std::endl;
+  std::cout << "                   stats)"
+    << std::endl;
+  std::cout << "   -m, --max-queues N" << std::endl;
+  std::cout << "                   most queues that can exist at once" 
     << std::endl;
   std::cout << "   -p, --port      listen port number (5672)" << std::endl;
+  std::cout << "   -u, --ingest    path" << std::endl;
+  std::cout << "                   Unix socket on which to accept messages"
+    << std::endl;
+  std::cout << "                   from other processes" << std::endl;
+  std::cout << "   -q, --queue-policy  name=[policy[:buffer]][,option]..." 
+    << std::endl;
+  std::cout << "                   delivery policy for a queue, or for all"
+    << std::endl;
+  std::cout << "                   queues if name is *. Policy is the slow-"
+    << std::endl;
+  std::cout << "                   consumer policy: drop-oldest, drop-newest,"
+    << std::endl;
+  std::cout << "                   or disconnect. Options are:" << std::endl;
+  std::cout << "                     last=N       last values kept for new"
+    << std::endl;
+  std::cout << "                                  subscribers" << std::endl;
+  std::cout << "                     replay=N     messages kept for clients"
+    << std::endl;
+  std::cout << "                                  that resume" << std::endl;
+  std::cout << "                     conflate     keep only the latest message"
+    << std::endl;
+  std::cout << "                                  for each key" << std::endl;
+  std::cout << "                     spool        also write messages to disk"
+    << std::endl;
+  std::cout << "                     spool-mb=N   most megabytes spooled" 
+    << std::endl;
+  std::cout << "                     spool-age=S  oldest message spooled, in"
+    << std::endl;
+  std::cout << "                                  seconds" << std::endl;
+  std::cout << "                     shm[=N]      also write messages to a"
+    << std::endl;
+  std::cout << "                                  shared memory ring of N"
+    << std::endl;
+  std::cout << "                                  slots" << std::endl;
+  std::cout << "   -d, --spool-dir path" << std::endl;
+  std::cout << "                   directory for the spools of queues with"
+    << std::endl;
+  std::cout << "                   the spool policy (" DEFAULT_SPOOL_DIR ")" 
+    << std::endl;
+  std::cout << "   -s, --shards    N" << std::endl;
+  std::cout << "                   run N shards, each with its own threads,"
+    << std::endl;
+  std::cout << "                   listening on port, port+1, ..." 
+    << std::endl;
+  std::cout << "   -t, --trigger   metric=name,rise=N[,clear=N][,stat=S]..."
+    << std::endl;
+  std::cout << "                   raise an alert on a metric; stat is value,"
+    << std::endl;
+  std::cout << "                   ewma, mean, max, or slope" << std::endl;
   std::cout << "   -v, --version   show version" << std::endl;
   }
 
@@ -60,14 +125,28 @@ int main (int argc, char **argv)
       {"version", no_argument, NULL, 'v'},
       {"log-level", required_argument, NULL, 'l'},
       {"cpu-load", required_argument, NULL, 'c'},
+      {"interval", required_argument, NULL, 'i'},
       {"port", required_argument, NULL, 'p'},
+      {"max-queues", required_argument, NULL, 'm'},
+      {"queue-policy", required_argument, NULL, 'q'},
+      {"shards", required_argument, NULL, 's'},
+      {"spool-dir", required_argument, NULL, 'd'},
+      {"trigger", required_argument, NULL, 't'},
+      {"ingest", required_argument, NULL, 'u'},
       {0, 0, 0, 0}
     };
 
   bool flag_version = false;
   bool flag_help = false;
   std::string port = "5672"; 
-  double cpu_load_threshold = 0.9;
+  std::string cpu_load = "0.9";
+  std::string ingest_path;
+  std::string spool_dir = DEFAULT_SPOOL_DIR;
+  int shards = 1;
+  long max_queues = DEFAULT_MAX_QUEUES;
+  TriggerList triggers;
+  std::map<std::string, QueuePolicy> queue_policies;
+  IntervalList intervals;
 
   int opt = 0;
   int ret = 0;
@@ -75,18 +154,33 @@ int main (int argc, char **argv)
   while (ret == 0)
     {
     int option_index = 0;
-    opt = getopt_long (argc, argv, "hvl:p:c:", long_options, &option_index);
+    opt = getopt_long (argc, argv, "hvl:m:p:c:d:q:i:s:t:u:", long_options, &option_index);
 
     if (opt == -1) break;
 
     switch (opt)
       {
       case 'c':
-        cpu_load_threshold = atof (optarg);
+        cpu_load = optarg;
         break;
       case 'h':
         flag_help = true;
         break;
+      case 'i':
+        {
+        std::string spec = optarg;
+        size_t eq = spec.find ('=');
+        int interval = eq == std::string::npos ? 0 
+          : atoi (spec.c_str() + eq + 1);
+        if (eq == 0 || interval <= 0)
+          {
+          DERR (log << "Invalid interval: " << spec;)
+          ret = 1;
+          }
+        else
+          intervals[spec.substr (0, eq)] = interval;
+        }
+        break;
       case 'v':
         flag_version = true;
         break;
@@ -96,11 +190,90 @@ int main (int argc, char **argv)
       case 'p':
         port = optarg;
         break;
+      case 'q':
+        {
+        std::string spec = optarg;
+        size_t eq = spec.find ('=');
+        QueuePolicy p;
+        if (eq == std::string::npos || eq == 0 
+              || !p.parse (spec.substr (eq + 1)))
+          {
+          DERR (log << "Invalid queue policy: " << spec;)
+          ret = 1;
+          }
+        else
+          queue_policies[spec.substr (0, eq)] = p;
+        }
+        break;
+      case 't':
+        {
+        std::string error;
+        Trigger *t = Trigger::parse (optarg, error);
+        if (t)
+          triggers.push_back (t);
+        else
+          {
+          DERR (log << "Invalid trigger: " << optarg << ": " 
+            << error;)
+          ret = 1;
+          }
+        }
+        break;
+      case 's':
+        shards = atoi (optarg);
+        if (shards < 1)
+          {
+          DERR (log << "Invalid number of shards: " << optarg;)
+          ret = 1;
+          }
+        break;
+      case 'u':
+        ingest_path = optarg;
+        break;
+      case 'd':
+        spool_dir = optarg;
+        break;
+      case 'm':
+        max_queues = atol (optarg);
+        if (max_queues < 1)
+          {
+          DERR (log << "Invalid number of queues: " << optarg;)
+          ret = 1;
+          }
+        break;
       default:
         ret = 1;
       }
     }
 
+  if (ret == 0)
+    {
+    // The load alert is just a trigger with its own queue and text
+    std::string levels[3];
+    size_t start = 0;
+    for (int i = 0; i < 3 && start <= cpu_load.size(); i++)
+      {
+      size_t end = cpu_load.find (':', start);
+      if (end == std::string::npos) end = cpu_load.size();
+      levels[i] = cpu_load.substr (start, end - start);
+      start = end + 1;
+      }
+    std::string spec = "metric=" LOAD_ALERT_METRIC ",queue=" LOAD_QUEUE 
+      ",text=CPU load alert,rise=" + levels[0];
+    if (!levels[1].empty()) spec += ",clear=" + levels[1];
+    if (!levels[2].empty()) spec += ",for=" + levels[2];
+    std::string error;
+    Trigger *t = Trigger::parse (spec, error);
+    if (t)
+      triggers.insert (triggers.begin(), t);
+    else
+      {
+      DERR (log << "Invalid CPU load: " << cpu_load << ": " 
+        << error;)
+      ret = 1;
+      }
+    }
+
   if (flag_version)
     {
     show_version();
@@ -119,14 +292,32 @@ int main (int argc, char **argv)
       {
       std::string address((std::string) "0.0.0.0" + ":" + port);
 
-      Server b (address);
-      std::thread t (monitor_thread, &b, cpu_load_threshold); 
+      Server b (address, shards);
+      b.set_spool_dir (spool_dir);
+      b.set_max_queues (max_queues);
+      for (std::map<std::string, QueuePolicy>::iterator i = 
+            queue_policies.begin(); i != queue_policies.end(); i++)
+        b.set_queue_policy (i->first, i->second);
+      Ingest *ingest = 0;
+      if (!ingest_path.empty())
+        {
+        std::string error;
+        ingest = Ingest::open (&b, ingest_path, error);
+        if (!ingest)
+          {
+          DERR (log << "Can't open ingest socket " << ingest_path << ": " 
+            << error;)
+          return 1;
+          }
+        std::thread (&Ingest::run, ingest).detach();
+        }
+      std::thread t (monitor_thread, &b, triggers, intervals); 
       b.run();
       } 
     catch (const std::exception& e) 
       {
-      DERR (std::cout << "Server shutdown on exception: " 
-         << e.what() << std::endl;)
+      DERR (log << "Server shutdown on exception: " 
+         << e.what();)
       }
     }
   if (ret == -1) ret = 0;
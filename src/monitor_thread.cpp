@@ -9,38 +9,155 @@
   and call Server.publish() to publish whatever messages are
   required, to create the appropriate notifications.
 
-  I've used CPU load here as an example, because it's easy to
-  measure. However, all kinds of things could be monitored, and
-  turned into AMQP messages. For example, the program could subscribe
-  to DBUS, and publish messages indicated that removeable disks 
-  have been plugged or unplugged. 
+  The actual measurements are made by Collectors -- one for the load
+  average, and one for each of the /proc files we read. Each metric
+  a Collector produces is published to the queue of the same name,
+  as a Metric: a structured message whose body is a list of its name,
+  value, unit, monotonic and wall-clock times, and labels. See 
+  Metric.h. Other things could be monitored by adding Collectors. For example, 
+  a Collector could subscribe to DBUS, and publish messages indicated
+  that removeable disks have been plugged or unplugged. 
+
+  Each Collector, and the "tick" message, is run by a Scheduler at
+  its own interval. Every sample is also passed to the ThresholdEngine,
+  which raises and clears alerts -- including the CPU load alert --
+  according to the Triggers.
 
   Copyright (c)2022 Kevin Boone, GPL v3.0
 
 =====================================================================*/
 
-#include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <iostream>
+#include <vector>
 
 #include "Server.h"
+#include "monitor_thread.h"
 #include "config.h"
 #include "logging.h"
+#include "DiskStatsCollector.h"
+#include "LoadAvgCollector.h"
+#include "MemInfoCollector.h"
+#include "NetDevCollector.h"
+#include "ProcStatCollector.h"
+#include "Scheduler.h"
+#include "Stats.h"
+#include "ThresholdEngine.h"
 
 /*=====================================================================
 
-  check_load 
+  PublishingSink
 
-  Returns true if the load average is above the set threshold
+  A MetricSink that publishes each metric to the queue of the same
+  name, and passes it to the ThresholdEngine.
 
 =====================================================================*/
-bool check_load (double load_threshold)
+class PublishingSink : public MetricSink
   {
-  double load = 0;
-  getloadavg (&load, 1);
-  DDBG (std::cout << "Load average is " << load << std::endl;)
-  return load > load_threshold;
+  private:
+
+  Server *server;
+  ThresholdEngine &engine;
+
+  public:
+
+  PublishingSink (Server *b, ThresholdEngine &e) : server (b), engine (e) 
+    {
+    }
+
+  void metric (const Metric& m) override
+    {
+    server->publish (m);
+    engine.sample (m.name, m.monotonic / 1e9, m.value);
+    }
+  };
+
+/*=====================================================================
+
+  publish_stats
+
+  Publish the server's own statistics. Everything is in the message
+  properties, so clients can use selectors on them; the text is a
+  summary for people.
+
+=====================================================================*/
+static void publish_stats (Server *b)
+  {
+  Stats::Snapshot s;
+  Stats::snapshot (s);
+  const uint64_t *c = s.counters;
+
+  proton::message::property_map props;
+  props.put ("published", c[Stats::PUBLISHED]);
+  props.put ("fanout_items", c[Stats::FANOUT_ITEMS]);
+  props.put ("deliveries", c[Stats::DELIVERIES]);
+  props.put ("sent", c[Stats::SENT]);
+  props.put ("batches", c[Stats::BATCHES]);
+  props.put ("buffered", c[Stats::BUFFERED]);
+  props.put ("dropped", c[Stats::DROPPED]);
+  props.put ("ingested", c[Stats::INGESTED]);
+  props.put ("ingest_rejected", c[Stats::INGEST_REJECTED]);
+  props.put ("received", c[Stats::RECEIVED]);
+  props.put ("receive_rejected", c[Stats::RECEIVE_REJECTED]);
+  props.put ("receiver_stalls", c[Stats::RECEIVER_STALLS]);
+  props.put ("spooled", c[Stats::SPOOLED]);
+  props.put ("spool_read", c[Stats::SPOOL_READ]);
+  props.put ("shm_written", c[Stats::SHM_WRITTEN]);
+  props.put ("queues_reclaimed", c[Stats::QUEUES_RECLAIMED]);
+  props.put ("queues_refused", c[Stats::QUEUES_REFUSED]);
+  // The work queue depths are the items added, less the items run.
+  //   The counts are read one at a time while other threads are
+  //   changing them, so a depth can be a little out.
+  props.put ("queue_work_depth", (int64_t)(c[Stats::QUEUE_WORK_ADDED] 
+    - c[Stats::QUEUE_WORK_DONE]));
+  props.put ("sender_work_depth", (int64_t)(c[Stats::SENDER_WORK_ADDED] 
+    - c[Stats::SENDER_WORK_DONE]));
+  props.put ("manager_work_depth", (int64_t)(c[Stats::MANAGER_WORK_ADDED] 
+    - c[Stats::MANAGER_WORK_DONE]));
+  props.put ("publish_us_p50", s.percentile (Stats::PUBLISH_TIME, 0.5) / 1e3);
+  props.put ("publish_us_p99", s.percentile (Stats::PUBLISH_TIME, 0.99) / 1e3);
+  props.put ("queue_latency_us_p50", 
+    s.percentile (Stats::QUEUE_LATENCY, 0.5) / 1e3);
+  props.put ("queue_latency_us_p99", 
+    s.percentile (Stats::QUEUE_LATENCY, 0.99) / 1e3);
+  props.put ("send_latency_us_p50", 
+    s.percentile (Stats::SEND_LATENCY, 0.5) / 1e3);
+  props.put ("send_latency_us_p99", 
+    s.percentile (Stats::SEND_LATENCY, 0.99) / 1e3);
+  props.put ("send_latency_us_p999", 
+    s.percentile (Stats::SEND_LATENCY, 0.999) / 1e3);
+
+  char text[160];
+  snprintf (text, sizeof (text), 
+    "published %llu, sent %llu, dropped %llu, p99 send latency %g us",
+    (unsigned long long)c[Stats::PUBLISHED], 
+    (unsigned long long)c[Stats::SENT], 
+    (unsigned long long)c[Stats::DROPPED], 
+    s.percentile (Stats::SEND_LATENCY, 0.99) / 1e3);
+  b->publish (SYS_STATS_QUEUE, text, props);
+  }
+
+/*=====================================================================
+
+  interval_for
+
+  Get the interval for a collector, either from the command line, or
+  the default. 
+
+=====================================================================*/
+static int interval_for (IntervalList& intervals, const std::string& name,
+      int def)
+  {
+  IntervalList::iterator i = intervals.find (name);
+  if (i == intervals.end()) return def;
+  int interval = i->second;
+  intervals.erase (i);
+  DINFO (log << "Interval for " << name << " is " << interval 
+     << " ms";)
+  return interval;
   }
 
 /*=====================================================================
@@ -49,38 +166,41 @@ bool check_load (double load_threshold)
 
 =====================================================================*/
 
-void monitor_thread (Server *b, double load_threshold)
+void monitor_thread (Server *b, TriggerList triggers, 
+       IntervalList intervals)
   {
-  // load_trip will be set true when the load avg has increased above
-  //  threshold, until it falls below threshold.
-  bool load_trip = false;
-  while (true)
+  ThresholdEngine engine (b, triggers);
+  PublishingSink sink (b, engine);
+  Scheduler scheduler (SCHEDULER_RESOLUTION, SCHEDULER_SLOTS);
+
+  // The tick's value is the number of ticks so far
+  Metric tick (TICK_QUEUE, "");
+  scheduler.add ("tick", interval_for (intervals, "tick", TICK_INTERVAL),
+    [b, &tick] { b->publish (tick.set (tick.value + 1)); });
+
+  scheduler.add ("stats", interval_for (intervals, "stats", STATS_INTERVAL),
+    [b] { publish_stats (b); });
+
+  Collector *collectors[] = 
     {
-    b->publish (TICK_QUEUE, "tick");
-    if (load_trip)
-      {
-      // We are already above threshold
-      if (!check_load (load_threshold))
-        {
-        // Fallen below threshold
-        load_trip = false;
-        DINFO (std::cout << "Load average has fallen below theshold" 
-           << std::endl;)
-        }
-      }
-    else
-      {
-      // We are presently below threshold
-      if (check_load (load_threshold))
-        {
-        // Risen above threshold
-        load_trip = true;
-        DINFO (std::cout << "Load average has risen above theshold" 
-           << std::endl;)
-        b->publish (LOAD_QUEUE, "CPU load alert");
-        }
-      }
-    usleep (TICK_INTERVAL);
+    new LoadAvgCollector(), new ProcStatCollector(), new MemInfoCollector(), 
+    new DiskStatsCollector(), new NetDevCollector()
+    };
+  int defaults[] = 
+    { LOADAVG_INTERVAL, STAT_INTERVAL, MEMINFO_INTERVAL, DISKSTATS_INTERVAL, 
+      NETDEV_INTERVAL };
+  for (size_t i = 0; i < sizeof (collectors) / sizeof (collectors[0]); i++)
+    {
+    Collector *c = collectors[i];
+    scheduler.add (c->get_name(), 
+      interval_for (intervals, c->get_name(), defaults[i]),
+      [c, &sink] { c->collect (sink); });
     }
+
+  for (IntervalList::iterator i = intervals.begin(); 
+        i != intervals.end(); i++)
+    DWARN (log << "Unknown collector in --interval: " << i->first;)
+
+  scheduler.run();
   }
 
@@ -8,7 +8,8 @@
   message server, and collects the information that is to 
   be published.
 
-  In this simple example, we just collect CPU load average figures.
+  In this simple example, we collect CPU load average figures, and 
+  various system statistics from /proc.
 
   Copyright (c)2022 Kevin Boone, GPL v3.0
 
@@ -16,7 +17,20 @@
 
 #pragma once
 
+#include <map>
+#include <string>
+
+#include "ThresholdEngine.h"
+
 class Server;
 
-void monitor_thread (Server *b, double load_threshold);
+/** IntervalList maps the name of a collector (or "tick") to the time
+    between its samples, in milliseconds. Collectors that are not in 
+    the list use the defaults in config.h. */
+typedef std::map<std::string, int> IntervalList;
 
+/** Run the collectors, publishing their metrics, and raising alerts 
+    according to the triggers. This function takes ownership of the
+    triggers, and never returns. */
+void monitor_thread (Server *b, TriggerList triggers, 
+    IntervalList intervals);